@@ -0,0 +1,483 @@
+/*
+ * SSD1322 Framebuffer Client Library
+ * ----------------------------------
+ *
+ * Filename: libssd1322fb.c
+ * License: GPL
+ *
+ * Description:
+ * ------------
+ * Implementation of the drawing and flushing calls in libssd1322fb.h. Build
+ * it with `make lib` and link applications against libssd1322fb.a.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <linux/fb.h>
+
+#include "libssd1322fb.h"
+
+// 8x8 font for ' ' to '~', one byte per row, bit 0 is the leftmost pixel
+static const uint8_t font8x8[SSD1322FB_GLYPHS][SSD1322FB_GLYPH_HEIGHT] = {
+        { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // ' '
+        { 0x18, 0x3C, 0x3C, 0x18, 0x18, 0x00, 0x18, 0x00 },   // '!'
+        { 0x36, 0x36, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // '"'
+        { 0x36, 0x36, 0x7F, 0x36, 0x7F, 0x36, 0x36, 0x00 },   // '#'
+        { 0x0C, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x0C, 0x00 },   // '$'
+        { 0x00, 0x63, 0x33, 0x18, 0x0C, 0x66, 0x63, 0x00 },   // '%'
+        { 0x1C, 0x36, 0x1C, 0x6E, 0x3B, 0x33, 0x6E, 0x00 },   // '&'
+        { 0x06, 0x06, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00 },   // '''
+        { 0x18, 0x0C, 0x06, 0x06, 0x06, 0x0C, 0x18, 0x00 },   // '('
+        { 0x06, 0x0C, 0x18, 0x18, 0x18, 0x0C, 0x06, 0x00 },   // ')'
+        { 0x00, 0x66, 0x3C, 0xFF, 0x3C, 0x66, 0x00, 0x00 },   // '*'
+        { 0x00, 0x0C, 0x0C, 0x3F, 0x0C, 0x0C, 0x00, 0x00 },   // '+'
+        { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x06 },   // ','
+        { 0x00, 0x00, 0x00, 0x3F, 0x00, 0x00, 0x00, 0x00 },   // '-'
+        { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x00 },   // '.'
+        { 0x60, 0x30, 0x18, 0x0C, 0x06, 0x03, 0x01, 0x00 },   // '/'
+        { 0x3E, 0x63, 0x73, 0x7B, 0x6F, 0x67, 0x3E, 0x00 },   // '0'
+        { 0x0C, 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x3F, 0x00 },   // '1'
+        { 0x1E, 0x33, 0x30, 0x1C, 0x06, 0x33, 0x3F, 0x00 },   // '2'
+        { 0x1E, 0x33, 0x30, 0x1C, 0x30, 0x33, 0x1E, 0x00 },   // '3'
+        { 0x38, 0x3C, 0x36, 0x33, 0x7F, 0x30, 0x78, 0x00 },   // '4'
+        { 0x3F, 0x03, 0x1F, 0x30, 0x30, 0x33, 0x1E, 0x00 },   // '5'
+        { 0x1C, 0x06, 0x03, 0x1F, 0x33, 0x33, 0x1E, 0x00 },   // '6'
+        { 0x3F, 0x33, 0x30, 0x18, 0x0C, 0x0C, 0x0C, 0x00 },   // '7'
+        { 0x1E, 0x33, 0x33, 0x1E, 0x33, 0x33, 0x1E, 0x00 },   // '8'
+        { 0x1E, 0x33, 0x33, 0x3E, 0x30, 0x18, 0x0E, 0x00 },   // '9'
+        { 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x00 },   // ':'
+        { 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x06 },   // ';'
+        { 0x18, 0x0C, 0x06, 0x03, 0x06, 0x0C, 0x18, 0x00 },   // '<'
+        { 0x00, 0x00, 0x3F, 0x00, 0x00, 0x3F, 0x00, 0x00 },   // '='
+        { 0x06, 0x0C, 0x18, 0x30, 0x18, 0x0C, 0x06, 0x00 },   // '>'
+        { 0x1E, 0x33, 0x30, 0x18, 0x0C, 0x00, 0x0C, 0x00 },   // '?'
+        { 0x3E, 0x63, 0x7B, 0x7B, 0x7B, 0x03, 0x1E, 0x00 },   // '@'
+        { 0x0C, 0x1E, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x00 },   // 'A'
+        { 0x3F, 0x66, 0x66, 0x3E, 0x66, 0x66, 0x3F, 0x00 },   // 'B'
+        { 0x3C, 0x66, 0x03, 0x03, 0x03, 0x66, 0x3C, 0x00 },   // 'C'
+        { 0x1F, 0x36, 0x66, 0x66, 0x66, 0x36, 0x1F, 0x00 },   // 'D'
+        { 0x7F, 0x46, 0x16, 0x1E, 0x16, 0x46, 0x7F, 0x00 },   // 'E'
+        { 0x7F, 0x46, 0x16, 0x1E, 0x16, 0x06, 0x0F, 0x00 },   // 'F'
+        { 0x3C, 0x66, 0x03, 0x03, 0x73, 0x66, 0x7C, 0x00 },   // 'G'
+        { 0x33, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x33, 0x00 },   // 'H'
+        { 0x1E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },   // 'I'
+        { 0x78, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E, 0x00 },   // 'J'
+        { 0x67, 0x66, 0x36, 0x1E, 0x36, 0x66, 0x67, 0x00 },   // 'K'
+        { 0x0F, 0x06, 0x06, 0x06, 0x46, 0x66, 0x7F, 0x00 },   // 'L'
+        { 0x63, 0x77, 0x7F, 0x7F, 0x6B, 0x63, 0x63, 0x00 },   // 'M'
+        { 0x63, 0x67, 0x6F, 0x7B, 0x73, 0x63, 0x63, 0x00 },   // 'N'
+        { 0x1C, 0x36, 0x63, 0x63, 0x63, 0x36, 0x1C, 0x00 },   // 'O'
+        { 0x3F, 0x66, 0x66, 0x3E, 0x06, 0x06, 0x0F, 0x00 },   // 'P'
+        { 0x1E, 0x33, 0x33, 0x33, 0x3B, 0x1E, 0x38, 0x00 },   // 'Q'
+        { 0x3F, 0x66, 0x66, 0x3E, 0x36, 0x66, 0x67, 0x00 },   // 'R'
+        { 0x1E, 0x33, 0x07, 0x0E, 0x38, 0x33, 0x1E, 0x00 },   // 'S'
+        { 0x3F, 0x2D, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },   // 'T'
+        { 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x3F, 0x00 },   // 'U'
+        { 0x33, 0x33, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00 },   // 'V'
+        { 0x63, 0x63, 0x63, 0x6B, 0x7F, 0x77, 0x63, 0x00 },   // 'W'
+        { 0x63, 0x63, 0x36, 0x1C, 0x1C, 0x36, 0x63, 0x00 },   // 'X'
+        { 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x0C, 0x1E, 0x00 },   // 'Y'
+        { 0x7F, 0x63, 0x31, 0x18, 0x4C, 0x66, 0x7F, 0x00 },   // 'Z'
+        { 0x1E, 0x06, 0x06, 0x06, 0x06, 0x06, 0x1E, 0x00 },   // '['
+        { 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x40, 0x00 },   // '\'
+        { 0x1E, 0x18, 0x18, 0x18, 0x18, 0x18, 0x1E, 0x00 },   // ']'
+        { 0x08, 0x1C, 0x36, 0x63, 0x00, 0x00, 0x00, 0x00 },   // '^'
+        { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF },   // '_'
+        { 0x0C, 0x0C, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00 },   // '`'
+        { 0x00, 0x00, 0x1E, 0x30, 0x3E, 0x33, 0x6E, 0x00 },   // 'a'
+        { 0x07, 0x06, 0x06, 0x3E, 0x66, 0x66, 0x3B, 0x00 },   // 'b'
+        { 0x00, 0x00, 0x1E, 0x33, 0x03, 0x33, 0x1E, 0x00 },   // 'c'
+        { 0x38, 0x30, 0x30, 0x3E, 0x33, 0x33, 0x6E, 0x00 },   // 'd'
+        { 0x00, 0x00, 0x1E, 0x33, 0x3F, 0x03, 0x1E, 0x00 },   // 'e'
+        { 0x1C, 0x36, 0x06, 0x0F, 0x06, 0x06, 0x0F, 0x00 },   // 'f'
+        { 0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x1F },   // 'g'
+        { 0x07, 0x06, 0x36, 0x6E, 0x66, 0x66, 0x67, 0x00 },   // 'h'
+        { 0x0C, 0x00, 0x0E, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },   // 'i'
+        { 0x30, 0x00, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E },   // 'j'
+        { 0x07, 0x06, 0x66, 0x36, 0x1E, 0x36, 0x67, 0x00 },   // 'k'
+        { 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },   // 'l'
+        { 0x00, 0x00, 0x33, 0x7F, 0x7F, 0x6B, 0x63, 0x00 },   // 'm'
+        { 0x00, 0x00, 0x1F, 0x33, 0x33, 0x33, 0x33, 0x00 },   // 'n'
+        { 0x00, 0x00, 0x1E, 0x33, 0x33, 0x33, 0x1E, 0x00 },   // 'o'
+        { 0x00, 0x00, 0x3B, 0x66, 0x66, 0x3E, 0x06, 0x0F },   // 'p'
+        { 0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x78 },   // 'q'
+        { 0x00, 0x00, 0x3B, 0x6E, 0x66, 0x06, 0x0F, 0x00 },   // 'r'
+        { 0x00, 0x00, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x00 },   // 's'
+        { 0x08, 0x0C, 0x3E, 0x0C, 0x0C, 0x2C, 0x18, 0x00 },   // 't'
+        { 0x00, 0x00, 0x33, 0x33, 0x33, 0x33, 0x6E, 0x00 },   // 'u'
+        { 0x00, 0x00, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00 },   // 'v'
+        { 0x00, 0x00, 0x63, 0x6B, 0x7F, 0x7F, 0x36, 0x00 },   // 'w'
+        { 0x00, 0x00, 0x63, 0x36, 0x1C, 0x36, 0x63, 0x00 },   // 'x'
+        { 0x00, 0x00, 0x33, 0x33, 0x33, 0x3E, 0x30, 0x1F },   // 'y'
+        { 0x00, 0x00, 0x3F, 0x19, 0x0C, 0x26, 0x3F, 0x00 },   // 'z'
+        { 0x38, 0x0C, 0x0C, 0x07, 0x0C, 0x0C, 0x38, 0x00 },   // '{'
+        { 0x18, 0x18, 0x18, 0x00, 0x18, 0x18, 0x18, 0x00 },   // '|'
+        { 0x07, 0x0C, 0x0C, 0x38, 0x0C, 0x0C, 0x07, 0x00 },   // '}'
+        { 0x6E, 0x3B, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // '~'
+};
+
+struct ssd1322fb_surface *ssd1322fb_open(const char *device)
+{
+        struct fb_var_screeninfo var;
+        struct fb_fix_screeninfo fix;
+        struct ssd1322fb_flush probe = { 0 };
+        struct ssd1322fb_surface *s;
+        int err;
+
+        s = calloc(1, sizeof(*s));
+        if (!s)
+                return NULL;
+
+        s->fd = open(device, O_RDWR | O_CLOEXEC);
+        if (s->fd < 0)
+                goto err_free;
+
+        if (ioctl(s->fd, FBIOGET_VSCREENINFO, &var))
+                goto err_close;
+        // Drawing is in the panel's native 4-bit gray
+        if (var.bits_per_pixel != 4) {
+                var.bits_per_pixel = 4;
+                if (ioctl(s->fd, FBIOPUT_VSCREENINFO, &var))
+                        goto err_close;
+        }
+        if (ioctl(s->fd, FBIOGET_FSCREENINFO, &fix))
+                goto err_close;
+
+        s->width = var.xres;
+        s->height = var.yres;
+        s->stride = fix.line_length;
+        s->rows = var.yres_virtual;
+        s->yoffset = var.yoffset;
+        s->size = fix.smem_len;
+
+        // A rectangle just off the screen damages nothing. Drivers from
+        // before the flush ioctl don't map their memory either: mmap may
+        // still succeed there, but the mapping isn't the framebuffer.
+        probe.x = s->width;
+        probe.width = 1;
+        probe.height = 1;
+        if (ioctl(s->fd, SSD1322FB_IOCTL_FLUSH, &probe)) {
+                if (errno != ENOTTY)
+                        goto err_close;
+                s->no_flush_ioctl = 1;
+        }
+
+        if (!s->no_flush_ioctl) {
+                s->pixels = mmap(NULL, s->size, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED, s->fd, 0);
+                if (s->pixels != MAP_FAILED) {
+                        s->mapped = 1;
+                        return s;
+                }
+        }
+
+        // Draw into a copy of the framebuffer memory instead
+        s->pixels = calloc(1, s->size);
+        if (!s->pixels)
+                goto err_close;
+        if (pread(s->fd, s->pixels, s->size, 0) < 0)
+                goto err_pixels;
+
+        return s;
+
+err_pixels:
+        err = errno;
+        free(s->pixels);
+        errno = err;
+err_close:
+        err = errno;
+        close(s->fd);
+        errno = err;
+err_free:
+        err = errno;
+        free(s);
+        errno = err;
+        return NULL;
+}
+
+void ssd1322fb_close(struct ssd1322fb_surface *s)
+{
+        if (!s)
+                return;
+
+        if (s->mapped)
+                munmap(s->pixels, s->size);
+        else
+                free(s->pixels);
+        close(s->fd);
+        free(s);
+}
+
+uint8_t *ssd1322fb_row(struct ssd1322fb_surface *s, unsigned int y)
+{
+        return s->pixels + (size_t)((s->yoffset + y) % s->rows) * s->stride;
+}
+
+static inline void put_nibble(uint8_t *row, unsigned int x, uint8_t gray)
+{
+        uint8_t *p = &row[x / 2];
+
+        // The left pixel is in the upper nibble
+        if (x & 1)
+                *p = (*p & 0xF0) | gray;
+        else
+                *p = (*p & 0x0F) | gray << 4;
+}
+
+static inline uint8_t get_nibble(const uint8_t *row, unsigned int x)
+{
+        return x & 1 ? row[x / 2] & 0x0F : row[x / 2] >> 4;
+}
+
+// Clip a rectangle to the screen, returns 0 if nothing is left. *dx and *dy
+// are set to how far the left and top edges moved.
+static int clip(const struct ssd1322fb_surface *s, int *x, int *y,
+                unsigned int *w, unsigned int *h, unsigned int *dx,
+                unsigned int *dy)
+{
+        long x1 = *x, y1 = *y;
+        long x2 = x1 + *w, y2 = y1 + *h;
+
+        if (x1 < 0)
+                x1 = 0;
+        if (y1 < 0)
+                y1 = 0;
+        if (x2 > (long)s->width)
+                x2 = s->width;
+        if (y2 > (long)s->height)
+                y2 = s->height;
+        if (x1 >= x2 || y1 >= y2)
+                return 0;
+
+        *dx = x1 - *x;
+        *dy = y1 - *y;
+        *x = x1;
+        *y = y1;
+        *w = x2 - x1;
+        *h = y2 - y1;
+
+        return 1;
+}
+
+static void add_damage(struct ssd1322fb_surface *s, unsigned int x,
+                       unsigned int y, unsigned int w, unsigned int h)
+{
+        if (s->x1 >= s->x2) {
+                s->x1 = x;
+                s->y1 = y;
+                s->x2 = x + w;
+                s->y2 = y + h;
+                return;
+        }
+
+        if (x < s->x1)
+                s->x1 = x;
+        if (y < s->y1)
+                s->y1 = y;
+        if (x + w > s->x2)
+                s->x2 = x + w;
+        if (y + h > s->y2)
+                s->y2 = y + h;
+}
+
+void ssd1322fb_damage(struct ssd1322fb_surface *s, int x, int y,
+                      unsigned int w, unsigned int h)
+{
+        unsigned int dx, dy;
+
+        if (clip(s, &x, &y, &w, &h, &dx, &dy))
+                add_damage(s, x, y, w, h);
+}
+
+void ssd1322fb_pixel(struct ssd1322fb_surface *s, int x, int y,
+                     uint8_t gray)
+{
+        if (x < 0 || y < 0 || x >= (int)s->width || y >= (int)s->height)
+                return;
+
+        put_nibble(ssd1322fb_row(s, y), x, gray & 0x0F);
+        add_damage(s, x, y, 1, 1);
+}
+
+void ssd1322fb_fill(struct ssd1322fb_surface *s, int x, int y,
+                    unsigned int w, unsigned int h, uint8_t gray)
+{
+        unsigned int dx, dy, i, x1, x2;
+        uint8_t *row;
+
+        if (!clip(s, &x, &y, &w, &h, &dx, &dy))
+                return;
+        gray &= 0x0F;
+
+        for (i = 0; i < h; i++) {
+                row = ssd1322fb_row(s, y + i);
+                x1 = x;
+                x2 = x + w;
+
+                // Odd edges share a byte with the neighbouring pixel
+                if (x1 & 1)
+                        put_nibble(row, x1++, gray);
+                if (x1 < x2 && (x2 & 1))
+                        put_nibble(row, --x2, gray);
+                if (x1 < x2)
+                        memset(row + x1 / 2, gray * 0x11, (x2 - x1) / 2);
+        }
+
+        add_damage(s, x, y, w, h);
+}
+
+void ssd1322fb_blit(struct ssd1322fb_surface *s, int x, int y,
+                    const uint8_t *src, size_t src_stride, unsigned int w,
+                    unsigned int h)
+{
+        unsigned int dx, dy, i, j, sx, x1, x2;
+        const uint8_t *from;
+        uint8_t *row;
+
+        if (!clip(s, &x, &y, &w, &h, &dx, &dy))
+                return;
+
+        for (i = 0; i < h; i++) {
+                row = ssd1322fb_row(s, y + i);
+                from = src + (dy + i) * src_stride;
+
+                // Nibbles don't line up, move pixel by pixel
+                if ((x ^ dx) & 1) {
+                        for (j = 0; j < w; j++)
+                                put_nibble(row, x + j,
+                                           get_nibble(from, dx + j));
+                        continue;
+                }
+
+                x1 = x;
+                x2 = x + w;
+                sx = dx;
+                if (x1 & 1)
+                        put_nibble(row, x1++, get_nibble(from, sx++));
+                if (x1 < x2 && (x2 & 1)) {
+                        x2--;
+                        put_nibble(row, x2, get_nibble(from, sx + x2 - x1));
+                }
+                if (x1 < x2)
+                        memcpy(row + x1 / 2, from + sx / 2, (x2 - x1) / 2);
+        }
+
+        add_damage(s, x, y, w, h);
+}
+
+static const struct ssd1322fb_glyph *get_glyph(struct ssd1322fb_surface *s,
+                                               char c, uint8_t fg, uint8_t bg)
+{
+        struct ssd1322fb_glyph *g;
+        const uint8_t *bits;
+        unsigned int r, i;
+
+        if (c < SSD1322FB_GLYPH_FIRST || c > SSD1322FB_GLYPH_LAST)
+                c = '?';
+        g = &s->glyphs[c - SSD1322FB_GLYPH_FIRST];
+        if (g->valid && g->fg == fg && g->bg == bg)
+                return g;
+
+        // Render the glyph once in these colors, then reuse it
+        bits = font8x8[c - SSD1322FB_GLYPH_FIRST];
+        for (r = 0; r < SSD1322FB_GLYPH_HEIGHT; r++) {
+                for (i = 0; i < SSD1322FB_GLYPH_WIDTH; i += 2) {
+                        uint8_t left = bits[r] >> i & 1 ? fg : bg;
+                        uint8_t right = bits[r] >> (i + 1) & 1 ? fg : bg;
+
+                        g->data[r * SSD1322FB_GLYPH_WIDTH / 2 + i / 2] =
+                                left << 4 | right;
+                }
+        }
+        g->fg = fg;
+        g->bg = bg;
+        g->valid = 1;
+
+        return g;
+}
+
+int ssd1322fb_text(struct ssd1322fb_surface *s, int x, int y, const char *str,
+                   uint8_t fg, uint8_t bg)
+{
+        const struct ssd1322fb_glyph *g;
+
+        fg &= 0x0F;
+        bg &= 0x0F;
+        for (; *str; str++) {
+                // Nothing more of the string can be visible
+                if (x >= (int)s->width)
+                        break;
+
+                g = get_glyph(s, *str, fg, bg);
+                ssd1322fb_blit(s, x, y, g->data, SSD1322FB_GLYPH_WIDTH / 2,
+                               SSD1322FB_GLYPH_WIDTH, SSD1322FB_GLYPH_HEIGHT);
+                x += SSD1322FB_GLYPH_WIDTH;
+        }
+
+        return x;
+}
+
+// Older drivers only update the panel on write(), so write the damaged rows
+// of the copy into the framebuffer
+static int write_rows(struct ssd1322fb_surface *s, uint32_t flags)
+{
+        unsigned int y = s->y1, first, n;
+        uint32_t crtc = 0;
+        size_t len;
+        off_t off;
+
+        while (y < s->y2) {
+                // Rows are contiguous up to the end of memory
+                first = (s->yoffset + y) % s->rows;
+                n = s->rows - first;
+                if (n > s->y2 - y)
+                        n = s->y2 - y;
+
+                off = (off_t)first * s->stride;
+                len = (size_t)n * s->stride;
+                if (pwrite(s->fd, s->pixels + off, len, off) != (ssize_t)len)
+                        return -1;
+                y += n;
+        }
+
+        // FBIO_WAITFORVSYNC waits for the update where it is supported
+        if ((flags & SSD1322FB_FLUSH_WAIT) &&
+            ioctl(s->fd, FBIO_WAITFORVSYNC, &crtc) && errno != ENOTTY)
+                return -1;
+
+        return 0;
+}
+
+int ssd1322fb_flush(struct ssd1322fb_surface *s, uint32_t flags)
+{
+        struct ssd1322fb_flush req = {
+                .x = s->x1,
+                .y = s->y1,
+                .width = s->x2 - s->x1,
+                .height = s->y2 - s->y1,
+                .flags = flags,
+        };
+
+        if (s->x1 >= s->x2)
+                return 0;
+
+        // Drawing into a copy needs the rows written, the driver can't
+        // see them otherwise
+        if (!s->mapped) {
+                if (write_rows(s, flags))
+                        return -1;
+        } else if (ioctl(s->fd, SSD1322FB_IOCTL_FLUSH, &req)) {
+                return -1;
+        }
+
+        s->x1 = s->x2 = 0;
+        s->y1 = s->y2 = 0;
+
+        return 0;
+}
@@ -0,0 +1,200 @@
+/*
+ * SSD1322 Framebuffer Client Library
+ * ----------------------------------
+ *
+ * Filename: libssd1322fb.h
+ * License: GPL
+ *
+ * Description:
+ * ------------
+ * Drawing on the SSD1322 framebuffer from applications without each of them
+ * packing pixels and deciding when to write. The library maps the
+ * framebuffer, draws 4-bit gray straight into it, remembers the area that
+ * changed and submits only that area with SSD1322FB_IOCTL_FLUSH, so the
+ * driver's incremental update path is used by default. Drivers without the
+ * flush ioctl get a write() of the changed rows instead.
+ *
+ * Usage:
+ * ------
+ * - ssd1322fb_open() the framebuffer device.
+ * - Draw with ssd1322fb_fill(), ssd1322fb_blit(), ssd1322fb_text() and
+ *   ssd1322fb_pixel(). Code drawing into surface->pixels itself reports the
+ *   area with ssd1322fb_damage().
+ * - ssd1322fb_flush() sends everything drawn since the last flush.
+ * - ssd1322fb_close() when done.
+ *
+ * Gray levels are 0 (off) to 15 (full). Drawing is clipped to the screen.
+ * A surface isn't safe to use from several threads at once.
+ *
+ */
+
+#ifndef LIBSSD1322FB_H
+#define LIBSSD1322FB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ssd1322fb_ioctl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Size of the built-in font's glyphs
+#define SSD1322FB_GLYPH_WIDTH 8
+#define SSD1322FB_GLYPH_HEIGHT 8
+
+// Characters the built-in font covers
+#define SSD1322FB_GLYPH_FIRST ' '
+#define SSD1322FB_GLYPH_LAST '~'
+#define SSD1322FB_GLYPHS (SSD1322FB_GLYPH_LAST - SSD1322FB_GLYPH_FIRST + 1)
+
+// Bytes of a packed glyph, two pixels per byte
+#define SSD1322FB_GLYPH_BYTES (SSD1322FB_GLYPH_WIDTH / 2 * SSD1322FB_GLYPH_HEIGHT)
+
+struct ssd1322fb_glyph
+{
+        uint8_t fg;             // Colors the glyph was rendered in
+        uint8_t bg;
+        uint8_t valid;
+        uint8_t data[SSD1322FB_GLYPH_BYTES];
+};
+
+struct ssd1322fb_surface
+{
+        int fd;
+        unsigned int width;     // Visible screen in pixels
+        unsigned int height;
+        unsigned int stride;    // Bytes per row
+        uint8_t *pixels;        // Framebuffer memory, or a copy of the screen
+        size_t size;            // Bytes mapped or allocated at pixels
+        unsigned int rows;      // Rows of memory at pixels
+        unsigned int yoffset;   // Memory row shown at the top of the screen
+        int mapped;             // pixels is the mmap'ed framebuffer
+        int no_flush_ioctl;     // Driver predates SSD1322FB_IOCTL_FLUSH,
+                                // so pixels is never the mapping
+
+        // Area drawn since the last flush, empty when x1 >= x2
+        unsigned int x1, y1, x2, y2;
+
+        // Rendered glyphs, by character
+        struct ssd1322fb_glyph glyphs[SSD1322FB_GLYPHS];
+};
+
+/**
+ * ssd1322fb_open - Open an SSD1322 framebuffer for drawing
+ * @device: Framebuffer device, e.g. /dev/fb0
+ *
+ * Switches the framebuffer to 4 bits per pixel if needed. The framebuffer
+ * is mapped only when the driver has SSD1322FB_IOCTL_FLUSH, which is
+ * probed without damaging anything. Otherwise, or if mapping fails,
+ * drawing goes to a copy of the framebuffer memory that ssd1322fb_flush()
+ * writes out.
+ *
+ * Return: The surface, or NULL with errno set on failure.
+ */
+struct ssd1322fb_surface *ssd1322fb_open(const char *device);
+
+/**
+ * ssd1322fb_close - Close a surface
+ * @s: Surface from ssd1322fb_open()
+ *
+ * Anything drawn but not flushed is not sent.
+ */
+void ssd1322fb_close(struct ssd1322fb_surface *s);
+
+/**
+ * ssd1322fb_row - Get the memory of a screen row
+ * @s: Surface
+ * @y: Row on the screen, below s->height
+ *
+ * Follows the panning offset, so rows are not always contiguous.
+ *
+ * Return: The first byte of the row.
+ */
+uint8_t *ssd1322fb_row(struct ssd1322fb_surface *s, unsigned int y);
+
+/**
+ * ssd1322fb_damage - Report an area drawn without the library
+ * @s: Surface
+ * @x: Left edge in pixels
+ * @y: Top edge in pixels
+ * @w: Width in pixels
+ * @h: Height in pixels
+ *
+ * The area is sent by the next ssd1322fb_flush().
+ */
+void ssd1322fb_damage(struct ssd1322fb_surface *s, int x, int y,
+                      unsigned int w, unsigned int h);
+
+/**
+ * ssd1322fb_pixel - Set one pixel
+ * @s: Surface
+ * @x: Column
+ * @y: Row
+ * @gray: Gray level (0-15)
+ */
+void ssd1322fb_pixel(struct ssd1322fb_surface *s, int x, int y,
+                     uint8_t gray);
+
+/**
+ * ssd1322fb_fill - Fill a rectangle with one gray level
+ * @s: Surface
+ * @x: Left edge in pixels
+ * @y: Top edge in pixels
+ * @w: Width in pixels
+ * @h: Height in pixels
+ * @gray: Gray level (0-15)
+ */
+void ssd1322fb_fill(struct ssd1322fb_surface *s, int x, int y,
+                    unsigned int w, unsigned int h, uint8_t gray);
+
+/**
+ * ssd1322fb_blit - Copy a 4-bit image onto the screen
+ * @s: Surface
+ * @x: Left edge on the screen in pixels
+ * @y: Top edge on the screen in pixels
+ * @src: Image, two pixels per byte with the left one in the upper nibble
+ * @src_stride: Bytes per image row
+ * @w: Image width in pixels
+ * @h: Image height in pixels
+ *
+ * Rows are copied a byte at a time when the image and the screen nibbles
+ * line up, i.e. when x is even, and pixel by pixel otherwise.
+ */
+void ssd1322fb_blit(struct ssd1322fb_surface *s, int x, int y,
+                    const uint8_t *src, size_t src_stride, unsigned int w,
+                    unsigned int h);
+
+/**
+ * ssd1322fb_text - Draw a string in the built-in 8x8 font
+ * @s: Surface
+ * @x: Left edge in pixels
+ * @y: Top edge in pixels
+ * @str: Text; characters outside ' ' to '~' are drawn as '?'
+ * @fg: Gray level of the glyphs
+ * @bg: Gray level behind the glyphs
+ *
+ * Glyphs are rendered once per color pair and then blitted, so redrawing
+ * text costs about as much as copying it.
+ *
+ * Return: The x position after the text.
+ */
+int ssd1322fb_text(struct ssd1322fb_surface *s, int x, int y, const char *str,
+                   uint8_t fg, uint8_t bg);
+
+/**
+ * ssd1322fb_flush - Send everything drawn since the last flush
+ * @s: Surface
+ * @flags: SSD1322FB_FLUSH_WAIT to return once the update is on the panel
+ *
+ * Return: 0 on success, -1 with errno set on failure. The area stays
+ * damaged after a failure.
+ */
+int ssd1322fb_flush(struct ssd1322fb_surface *s, uint32_t flags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSSD1322FB_H */
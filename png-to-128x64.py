@@ -1,95 +1,219 @@
+import argparse
 import os
+import subprocess
 import sys
-from PIL import Image
+import time
 
-def process_pixel(pixel_value):
-    # Convert 8-bit grayscale (0-255) to 4-bit grayscale (0-15)
-    return pixel_value // 16
+import numpy as np
+from PIL import Image, ImageSequence
 
-def convert_image_to_4bit_grayscale(image_path, output_path=None):
-    # Open the image
-    img = Image.open(image_path)
-    
+# Panel size, overridden with --size or read from the framebuffer
+DEFAULT_WIDTH = 128
+DEFAULT_HEIGHT = 64
+
+IMAGE_EXTENSIONS = ('.png', '.jpg', '.jpeg', '.bmp', '.gif', '.tif', '.tiff', '.webp')
+VIDEO_EXTENSIONS = ('.mp4', '.mkv', '.avi', '.mov', '.webm', '.m4v')
+
+# 4x4 Bayer matrix for ordered dithering, thresholds 0-15
+BAYER_4X4 = np.array([[0, 8, 2, 10],
+                      [12, 4, 14, 6],
+                      [3, 11, 1, 9],
+                      [15, 7, 13, 5]], dtype=np.float32)
+
+def to_grayscale(img, width, height):
     # Handle transparency by converting to RGBA and applying a white background
-    if img.mode == 'P' or img.mode == 'RGBA':
+    if img.mode == 'P' or img.mode == 'RGBA' or img.mode == 'LA':
         img = img.convert('RGBA')
-        # Create a new image with a white background
         background = Image.new('RGBA', img.size, (255, 255, 255, 255))
-        # Paste the original image on the background, using alpha channel as mask
         img = Image.alpha_composite(background, img)
 
-    # Convert image to grayscale ('L' mode)
-    img = img.convert('L')
-
-    # Resize image to 128x64
-    img = img.resize((128, 64))
-
-    # Initialize an empty list to hold the converted pixel data
-    bitmap_data = []
-
-    # Process the image in pairs of pixels (two 4-bit pixels per byte)
-    for y in range(64):  # Ensuring 64 rows
-        for x in range(0, 128, 2):  # Step through pixels two at a time
-            # Get the first pixel value (0-255 grayscale) and convert it
-            pixel_value1 = img.getpixel((x, y))
-            first_pixel = process_pixel(pixel_value1)
-
-            # Get the second pixel value (0-255 grayscale) and convert it
-            pixel_value2 = img.getpixel((x + 1, y))
-            second_pixel = process_pixel(pixel_value2)
-
-            # Combine two 4-bit values into one byte
-            combined_byte = (first_pixel << 4) | second_pixel
-
-            # Add the processed byte to the bitmap data
-            bitmap_data.append(combined_byte)
-
-    # Ensure the final size is exactly 4096 bytes
-    if len(bitmap_data) != 128 * 64 // 2:
-        print(f"Error: Expected 4096 bytes, got {len(bitmap_data)} bytes.")
-        return
-
-    # If no output path is provided, create a default one
-    if output_path is None:
-        base_name = os.path.splitext(image_path)[0]
-        output_path = f"{base_name}-4bit.bin"
-
-    # Save the bitmap data to the output file
+    # Convert to grayscale ('L' mode) at the panel size
+    img = img.convert('L').resize((width, height))
+    return np.asarray(img, dtype=np.uint8)
+
+def quantize(gray, dither=False):
+    # Map 8-bit gray to the panel's 16 levels for the whole frame at once
+    if not dither:
+        return gray >> 4
+
+    # Ordered dithering: spread the rounding error over a 4x4 pattern
+    height, width = gray.shape
+    thresholds = np.tile((BAYER_4X4 + 0.5) / 16, (height // 4 + 1, width // 4 + 1))
+    levels = gray.astype(np.float32) * (15 / 255) + thresholds[:height, :width]
+    return np.clip(levels, 0, 15).astype(np.uint8)
+
+def pack_nibbles(levels):
+    # Two 4-bit pixels per byte, the left one in the upper nibble
+    return ((levels[:, 0::2] << 4) | levels[:, 1::2]).astype(np.uint8)
+
+def convert_frame(img, width, height, dither=False):
+    return pack_nibbles(quantize(to_grayscale(img, width, height), dither)).tobytes()
+
+def image_frames(path, width, height, dither):
+    # Every frame of a GIF or other multi-frame image, one frame otherwise
+    with Image.open(path) as img:
+        for frame in ImageSequence.Iterator(img):
+            yield convert_frame(frame, width, height, dither)
+
+def video_frames(path, width, height, dither, fps=None):
+    # Let ffmpeg decode and scale; it hands over raw 8-bit gray frames
+    cmd = ['ffmpeg', '-v', 'error', '-i', path]
+    if fps:
+        cmd += ['-r', str(fps)]
+    cmd += ['-vf', f'scale={width}:{height}', '-f', 'rawvideo', '-pix_fmt', 'gray', '-']
+
+    frame_size = width * height
+    try:
+        proc = subprocess.Popen(cmd, stdout=subprocess.PIPE)
+    except FileNotFoundError:
+        sys.exit(f"Error: ffmpeg is required to read {path}")
+
+    with proc:
+        while True:
+            raw = proc.stdout.read(frame_size)
+            if len(raw) < frame_size:
+                break
+            gray = np.frombuffer(raw, dtype=np.uint8).reshape(height, width)
+            yield pack_nibbles(quantize(gray, dither)).tobytes()
+
+def expand_inputs(inputs):
+    # Directories contribute their images in name order
+    for path in inputs:
+        if os.path.isdir(path):
+            for name in sorted(os.listdir(path)):
+                if name.lower().endswith(IMAGE_EXTENSIONS + VIDEO_EXTENSIONS):
+                    yield os.path.join(path, name)
+        else:
+            yield path
+
+def all_frames(inputs, width, height, dither, fps=None):
+    for path in expand_inputs(inputs):
+        if path.lower().endswith(VIDEO_EXTENSIONS):
+            yield from video_frames(path, width, height, dither, fps)
+        else:
+            yield from image_frames(path, width, height, dither)
+
+def read_fb_attr(fb_path, name):
+    # Geometry from /sys/class/graphics/fbN, None when not available
+    sysfs = os.path.join('/sys/class/graphics', os.path.basename(fb_path), name)
+    try:
+        with open(sysfs) as f:
+            return f.read().strip()
+    except OSError:
+        return None
+
+def stream_to_fb(frames, fb_path, width, height, fps, loops):
+    stride = int(read_fb_attr(fb_path, 'stride') or width // 2)
+    bpp = read_fb_attr(fb_path, 'bits_per_pixel')
+    if bpp is not None and bpp != '4':
+        sys.exit(f"Error: {fb_path} is at {bpp} bits per pixel, expected 4")
+
+    # Keep the frames when the sequence is played more than once
+    if loops != 1:
+        frames = list(frames)
+
+    period = 1.0 / fps if fps else 0
+    count = 0
+    fd = os.open(fb_path, os.O_WRONLY)
+    try:
+        deadline = time.monotonic()
+        played = 0
+        while loops == 0 or played < loops:
+            for data in frames:
+                # Pad each row out to the framebuffer's line length
+                if stride != width // 2:
+                    rows = np.frombuffer(data, dtype=np.uint8).reshape(height, width // 2)
+                    padded = np.zeros((height, stride), dtype=np.uint8)
+                    padded[:, :width // 2] = rows
+                    data = padded.tobytes()
+
+                if period:
+                    deadline += period
+                    delay = deadline - time.monotonic()
+                    if delay > 0:
+                        time.sleep(delay)
+                    elif delay < -period:
+                        # Too far behind to catch up; drop the backlog
+                        deadline = time.monotonic()
+
+                os.pwrite(fd, data, 0)
+                count += 1
+            played += 1
+    except KeyboardInterrupt:
+        pass
+    finally:
+        os.close(fd)
+
+    print(f"Streamed {count} frames to {fb_path}")
+
+def write_stream(frames, output_path):
+    count = 0
     with open(output_path, 'wb') as f:
-        f.write(bytearray(bitmap_data))
-
-    print(f"Image successfully converted and saved to {output_path}")
-
-def print_usage():
-    usage_text = """
-Usage: python script.py <input_image> [output_file]
-
-Arguments:
-  <input_image>   Path to the input image file (required).
-  [output_file]   Optional. Path to the output binary file. If not provided, the output will be named as the input image with '-4bit.bin' appended.
-
-Options:
-  -h, --help      Show this help message and exit.
-"""
-    print(usage_text)
+        for data in frames:
+            f.write(data)
+            count += 1
+
+    if count == 1:
+        print(f"Image successfully converted and saved to {output_path}")
+    else:
+        print(f"{count} frames converted and saved to {output_path}")
+
+def parse_size(text):
+    try:
+        width, height = (int(v) for v in text.lower().split('x'))
+    except ValueError:
+        raise argparse.ArgumentTypeError(f"invalid size '{text}', expected WxH")
+    if width <= 0 or height <= 0 or width % 2:
+        raise argparse.ArgumentTypeError(f"invalid size '{text}', width must be even")
+    return width, height
+
+def parse_args():
+    parser = argparse.ArgumentParser(
+        description="Convert images, GIFs and videos to the SSD1322 4-bit grayscale format.",
+        epilog="With one input image and a second path that doesn't exist, the second path "
+               "is the output file, as in earlier versions of this script.")
+    parser.add_argument('inputs', nargs='+',
+                        help="images, GIFs, videos or directories of them, in playback order")
+    parser.add_argument('-o', '--output',
+                        help="output file; frames are concatenated (default: <first input>-4bit.bin)")
+    parser.add_argument('--fb', metavar='DEVICE',
+                        help="stream the frames to a framebuffer such as /dev/fb0 instead of a file")
+    parser.add_argument('--fps', type=float, default=0,
+                        help="frame rate for --fb and for sampling videos (default: as fast as possible)")
+    parser.add_argument('--loop', type=int, default=1,
+                        help="times to play the frames with --fb, 0 for forever (default: 1)")
+    parser.add_argument('--dither', action='store_true',
+                        help="use ordered dithering instead of truncating to 16 levels")
+    parser.add_argument('--size', type=parse_size,
+                        help="panel size as WxH (default: from --fb, else 128x64)")
+    args = parser.parse_args()
+
+    # Old usage: <input_image> [output_file]
+    if (args.output is None and args.fb is None and len(args.inputs) == 2
+            and not os.path.exists(args.inputs[1])):
+        args.output = args.inputs.pop()
+
+    return args
 
 if __name__ == "__main__":
-    # Check for help flag
-    if len(sys.argv) == 2 and sys.argv[1] in ("-h", "--help"):
-        print_usage()
-        sys.exit(0)
-
-    # Check for at least one argument (input file)
-    if len(sys.argv) < 2:
-        print("Error: Input image is required.")
-        print_usage()
-        sys.exit(1)
-
-    # Input image path
-    input_image = sys.argv[1]
-
-    # Optional output path
-    output_file = sys.argv[2] if len(sys.argv) > 2 else None
-
-    # Call the conversion function
-    convert_image_to_4bit_grayscale(input_image, output_file)
+    args = parse_args()
+
+    if args.size:
+        width, height = args.size
+    else:
+        width, height = DEFAULT_WIDTH, DEFAULT_HEIGHT
+        # The first mode, e.g. "U:128x64p-0"; virtual_size includes the pan pages
+        modes = read_fb_attr(args.fb, 'modes') if args.fb else None
+        if modes:
+            mode = modes.splitlines()[0].split(':')[-1]
+            width, height = parse_size(mode.split('p')[0].split('i')[0])
+
+    frames = all_frames(args.inputs, width, height, args.dither, args.fps)
+
+    if args.fb:
+        stream_to_fb(frames, args.fb, width, height, args.fps, args.loop)
+    else:
+        output = args.output
+        if output is None:
+            output = f"{os.path.splitext(args.inputs[0].rstrip(os.sep))[0]}-4bit.bin"
+        write_stream(frames, output)
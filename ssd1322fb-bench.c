@@ -0,0 +1,324 @@
+/*
+ * SSD1322 Framebuffer Benchmark
+ * -----------------------------
+ *
+ * Filename: ssd1322fb-bench.c
+ * License: GPL
+ *
+ * Description:
+ * ------------
+ * Measures how fast the SSD1322 framebuffer driver gets pixels onto the
+ * panel. Each workload draws frames that differ from the previous one and
+ * waits until the driver reports them on the panel, so the numbers include
+ * the diff, the encoding and the SPI transfer.
+ *
+ * Workloads:
+ * ----------
+ * - write: full frames with write(), timed from the write until the frame
+ *   is on the panel (FBIO_WAITFORVSYNC).
+ * - full: full frames drawn through mmap and sent with
+ *   SSD1322FB_IOCTL_FLUSH and SSD1322FB_FLUSH_WAIT.
+ * - small: a 16x8 rectangle drawn through mmap and flushed.
+ * - scroll: the screen panned down by one row with FBIOPAN_DISPLAY and the
+ *   new row drawn, as a console scrolls.
+ *
+ * For each workload the tool prints the latency (min, average, 99th
+ * percentile, max), the sustained frame rate and, when the driver's debugfs
+ * directory is given, the bytes sent per frame.
+ *
+ * Usage:
+ * ------
+ *   make bench
+ *   sudo ./ssd1322fb-bench -d /dev/fb0 -n 200 \
+ *        -s /sys/kernel/debug/ssd1322fb-spi0.0 [workload...]
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/fb.h>
+
+#include "ssd1322fb_ioctl.h"
+
+#define DEFAULT_DEVICE "/dev/fb0"
+#define DEFAULT_FRAMES 100
+
+// Rectangle redrawn by the small workload
+#define SMALL_WIDTH 16
+#define SMALL_HEIGHT 8
+
+struct bench
+{
+        int fd;
+        const char *stats_dir;  // debugfs directory of the device, or NULL
+        struct fb_var_screeninfo var;
+        struct fb_fix_screeninfo fix;
+        uint8_t *map;           // mmap of the framebuffer memory
+        uint8_t *frame;         // One screen, for write()
+        unsigned int frames;    // Frames per workload
+        double *lat_us;         // Latency of every frame
+};
+
+struct workload
+{
+        const char *name;
+        int (*run)(struct bench *b, unsigned int n);
+};
+
+static double now_us(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Counter from the driver's debugfs directory, -1 if unavailable
+static long long read_stat(struct bench *b, const char *name)
+{
+        char path[256];
+        long long val;
+        FILE *f;
+
+        if (!b->stats_dir)
+                return -1;
+        snprintf(path, sizeof(path), "%s/%s", b->stats_dir, name);
+        f = fopen(path, "r");
+        if (!f)
+                return -1;
+        if (fscanf(f, "%lld", &val) != 1)
+                val = -1;
+        fclose(f);
+
+        return val;
+}
+
+// Gray level of pixel (x, y) in frame n, different in every frame
+static uint8_t pattern(unsigned int x, unsigned int y, unsigned int n)
+{
+        return (x / 4 + y + n) & 0x0F;
+}
+
+static void draw(struct bench *b, uint8_t *base, unsigned int x0,
+                 unsigned int y0, unsigned int w, unsigned int h,
+                 unsigned int n)
+{
+        unsigned int x, y;
+        uint8_t *row;
+
+        // Two pixels per byte, the left one in the upper nibble
+        for (y = y0; y < y0 + h; y++) {
+                row = base + y * b->fix.line_length;
+                for (x = x0; x < x0 + w; x += 2)
+                        row[x / 2] = pattern(x, y, n) << 4 |
+                                     pattern(x + 1, y, n);
+        }
+}
+
+static int flush(struct bench *b, unsigned int x, unsigned int y,
+                 unsigned int w, unsigned int h)
+{
+        struct ssd1322fb_flush req = {
+                .x = x,
+                .y = y,
+                .width = w,
+                .height = h,
+                .flags = SSD1322FB_FLUSH_WAIT,
+        };
+
+        return ioctl(b->fd, SSD1322FB_IOCTL_FLUSH, &req);
+}
+
+static int run_write(struct bench *b, unsigned int n)
+{
+        size_t len = b->fix.line_length * b->var.yres;
+        uint32_t crtc = 0;
+
+        draw(b, b->frame, 0, 0, b->var.xres, b->var.yres, n);
+        if (pwrite(b->fd, b->frame, len, 0) != (ssize_t)len)
+                return -1;
+
+        return ioctl(b->fd, FBIO_WAITFORVSYNC, &crtc);
+}
+
+static int run_full(struct bench *b, unsigned int n)
+{
+        draw(b, b->map, 0, 0, b->var.xres, b->var.yres, n);
+        return flush(b, 0, 0, b->var.xres, b->var.yres);
+}
+
+static int run_small(struct bench *b, unsigned int n)
+{
+        unsigned int x = (n * SMALL_WIDTH) % (b->var.xres - SMALL_WIDTH + 1);
+        unsigned int y = (n * SMALL_HEIGHT) % (b->var.yres - SMALL_HEIGHT + 1);
+
+        draw(b, b->map, x & ~1U, y, SMALL_WIDTH, SMALL_HEIGHT, n);
+        return flush(b, x & ~1U, y, SMALL_WIDTH, SMALL_HEIGHT);
+}
+
+static int run_scroll(struct bench *b, unsigned int n)
+{
+        struct fb_var_screeninfo var = b->var;
+        unsigned int bottom;
+        uint32_t crtc = 0;
+
+        // The row that scrolls in, drawn before the pan shows it
+        var.yoffset = (n + 1) % var.yres_virtual;
+        bottom = (var.yoffset + var.yres - 1) % var.yres_virtual;
+        draw(b, b->map, 0, bottom, var.xres, 1, n);
+        var.vmode |= FB_VMODE_YWRAP;
+        if (ioctl(b->fd, FBIOPAN_DISPLAY, &var))
+                return -1;
+
+        return ioctl(b->fd, FBIO_WAITFORVSYNC, &crtc);
+}
+
+static const struct workload workloads[] = {
+        { "write", run_write },
+        { "full", run_full },
+        { "small", run_small },
+        { "scroll", run_scroll },
+};
+
+static int cmp_double(const void *a, const void *b)
+{
+        double x = *(const double *)a;
+        double y = *(const double *)b;
+
+        return (x > y) - (x < y);
+}
+
+static int run(struct bench *b, const struct workload *w)
+{
+        long long bytes_start, bytes_end;
+        double start, elapsed, sum = 0;
+        unsigned int i;
+
+        bytes_start = read_stat(b, "bytes_on_wire");
+        start = now_us();
+        for (i = 0; i < b->frames; i++) {
+                double t = now_us();
+
+                if (w->run(b, i)) {
+                        fprintf(stderr, "%s: frame %u: %s\n", w->name, i,
+                                strerror(errno));
+                        return -1;
+                }
+                b->lat_us[i] = now_us() - t;
+                sum += b->lat_us[i];
+        }
+        elapsed = now_us() - start;
+        bytes_end = read_stat(b, "bytes_on_wire");
+
+        qsort(b->lat_us, b->frames, sizeof(*b->lat_us), cmp_double);
+        printf("%-7s latency us min %8.0f avg %8.0f p99 %8.0f max %8.0f  "
+               "%6.1f fps",
+               w->name, b->lat_us[0], sum / b->frames,
+               b->lat_us[(b->frames * 99) / 100], b->lat_us[b->frames - 1],
+               b->frames * 1e6 / elapsed);
+        if (bytes_start >= 0 && bytes_end >= 0)
+                printf("  %8.0f bytes/frame",
+                       (double)(bytes_end - bytes_start) / b->frames);
+        printf("\n");
+
+        return 0;
+}
+
+static void usage(const char *prog)
+{
+        fprintf(stderr,
+                "usage: %s [-d device] [-n frames] [-s debugfs dir] "
+                "[write|full|small|scroll...]\n",
+                prog);
+}
+
+int main(int argc, char **argv)
+{
+        struct bench b = { .frames = DEFAULT_FRAMES };
+        const char *device = DEFAULT_DEVICE;
+        unsigned int i;
+        int ret = 0;
+        int opt;
+
+        while ((opt = getopt(argc, argv, "d:n:s:h")) != -1) {
+                switch (opt) {
+                case 'd':
+                        device = optarg;
+                        break;
+                case 'n':
+                        b.frames = strtoul(optarg, NULL, 0);
+                        break;
+                case 's':
+                        b.stats_dir = optarg;
+                        break;
+                default:
+                        usage(argv[0]);
+                        return opt == 'h' ? 0 : 1;
+                }
+        }
+        if (!b.frames) {
+                usage(argv[0]);
+                return 1;
+        }
+
+        b.fd = open(device, O_RDWR);
+        if (b.fd < 0) {
+                perror(device);
+                return 1;
+        }
+        if (ioctl(b.fd, FBIOGET_VSCREENINFO, &b.var) ||
+            ioctl(b.fd, FBIOGET_FSCREENINFO, &b.fix)) {
+                perror("FBIOGET_*SCREENINFO");
+                return 1;
+        }
+        // The workloads draw 4-bit gray
+        if (b.var.bits_per_pixel != 4) {
+                b.var.bits_per_pixel = 4;
+                if (ioctl(b.fd, FBIOPUT_VSCREENINFO, &b.var) ||
+                    ioctl(b.fd, FBIOGET_FSCREENINFO, &b.fix)) {
+                        perror("FBIOPUT_VSCREENINFO");
+                        return 1;
+                }
+        }
+
+        b.map = mmap(NULL, b.fix.smem_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     b.fd, 0);
+        b.frame = malloc(b.fix.line_length * b.var.yres);
+        b.lat_us = calloc(b.frames, sizeof(*b.lat_us));
+        if (b.map == MAP_FAILED || !b.frame || !b.lat_us) {
+                perror("setup");
+                return 1;
+        }
+
+        printf("%s: %ux%u, %u frames per workload\n", device, b.var.xres,
+               b.var.yres, b.frames);
+
+        for (i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+                int j, selected = optind == argc;
+
+                for (j = optind; j < argc; j++)
+                        selected |= !strcmp(argv[j], workloads[i].name);
+                if (selected && run(&b, &workloads[i]))
+                        ret = 1;
+        }
+
+        // Back to the first screen page
+        b.var.yoffset = 0;
+        ioctl(b.fd, FBIOPAN_DISPLAY, &b.var);
+
+        munmap(b.map, b.fix.smem_len);
+        free(b.lat_us);
+        free(b.frame);
+        close(b.fd);
+
+        return ret;
+}
@@ -21,6 +21,7 @@
  * - 128x64 pixel resolution.
  * - 4-bit grayscale support.
  * - Basic framebuffer operations.
+ * - mmap support through deferred I/O.
  * - NHD-2.7-12864WDXX
  *
  * Requirements:
@@ -41,360 +42,3563 @@
 
 #include "ssd1322fb.h"
 
+#define CREATE_TRACE_POINTS
+#include "ssd1322fb_trace.h"
+
+// Power-on command sequence. Each entry is a command byte, the number of
+// data bytes and the data bytes.
+static const u8 ssd1322_init_seq[] = {
+	SSD1322_CMD_DISPLAY_ON, 0,
+	SSD1322_CMD_COMMAND_LOCK, 1, 0x12,
+	SSD1322_CMD_SET_CLOCK_DIV, 1, DISPLAY_CLOCK_FREQUENCY,
+	SSD1322_CMD_SET_MULTIPLEX_RATIO, 1, MULTIPLEX_RATIO,
+	SSD1322_CMD_SET_DISPLAY_OFFSET, 1, DISPLAY_OFFSET,
+	SSD1322_CMD_FUNCTION_SELECTION, 1, FUNCTION_SELECTION,
+	SSD1322_CMD_SET_START_LINE, 1, START_LINE,
+	SSD1322_CMD_SET_REMAP, 2, REMAP_SETTINGS,
+	SSD1322_CMD_MASTER_CONTRAST, 1, MASTER_CONTRAST_LEVEL,
+	SSD1322_CMD_CONTRAST_CONTROL, 1, CONTRAST_CONTROL_LEVEL,
+	SSD1322_CMD_PHASE_LENGTH, 1, PHASE_LENGTH,
+	SSD1322_CMD_PRECHARGE_VOLTAGE, 1, PRECHARGE_VOLTAGE_LEVEL,
+	SSD1322_CMD_EXTERNAL_VSL, 2, EXTERNAL_VSL,
+	SSD1322_CMD_VCOMH_VOLTAGE, 1, VCOMH_VOLTAGE_LEVEL,
+	SSD1322_CMD_DISPLAY_MODE, 0,
+	SSD1322_CMD_EXIT_PARTIAL_DISPLAY, 0,
+	SSD1322_CMD_DISPLAY_ENHANCEMENT, 2, DISPLAY_ENHANCEMENT_A,
+	DISPLAY_ENHANCEMENT_B,
+	SSD1322_CMD_SET_GPIO, 1, GPIO_SETTING,
+	SSD1322_CMD_DEFAULT_GRAYSCALE, 0,
+	SSD1322_CMD_SECOND_PRECHARGE, 1, SECOND_PRECHARGE_PERIOD,
+	SSD1322_CMD_DISPLAY_ON, 0,
+};
+
+static int ssd1322_build_init(struct ssd1322fb_par *par)
+{
+	struct device *dev = &par->spi->dev;
+	const u8 *seq = ssd1322_init_seq;
+	size_t seq_len = sizeof(ssd1322_init_seq);
+	size_t nwords = 0;
+	u8 *dt_seq = NULL;
+	u16 *words;
+	size_t i, w;
+	int count;
+	int ret;
+	u8 k;
+
+	// Panel variants can replace the whole sequence from the device tree
+	count = device_property_count_u8(dev, "ssd,init-sequence");
+	if (count > 0) {
+		dt_seq = kmalloc(count, GFP_KERNEL);
+		if (!dt_seq)
+			return -ENOMEM;
+		ret = device_property_read_u8_array(dev, "ssd,init-sequence",
+						    dt_seq, count);
+		if (ret)
+			goto out;
+		seq = dt_seq;
+		seq_len = count;
+	}
+
+	for (i = 0; i < seq_len; i += 2 + seq[i + 1]) {
+		if (i + 1 >= seq_len || i + 2 + seq[i + 1] > seq_len) {
+			dev_err(dev, "Truncated init sequence at byte %zu\n", i);
+			ret = -EINVAL;
+			goto out;
+		}
+		nwords += 1 + seq[i + 1];
+	}
+
+	ret = -ENOMEM;
+	words = kmalloc_array(nwords, sizeof(*words), GFP_KERNEL);
+	if (!words)
+		goto out;
+	for (i = 0, w = 0; i < seq_len; i += 2 + seq[i + 1]) {
+		words[w++] = seq[i];
+		for (k = 0; k < seq[i + 1]; k++)
+			words[w++] = 0x100 | seq[i + 2 + k];
+
+		// The built-in sequence drives as many rows as the panel has
+		if (!dt_seq && seq[i] == SSD1322_CMD_SET_MULTIPLEX_RATIO)
+			words[w - 1] = 0x100 | (par->height - 1);
+	}
+
+	// Encoded once into a DMA-safe buffer. The commands are sent as one
+	// stream of words, so CS never has to toggle in between.
+	par->init_buf = kmalloc(nwords * sizeof(u16), GFP_KERNEL);
+	if (par->init_buf) {
+		par->init_len = ssd1322_encode_words(par, par->init_buf, words,
+						     nwords);
+		par->init_words = nwords;
+		par->init_cmd = seq[0];
+		ret = 0;
+	}
+	kfree(words);
+out:
+	kfree(dt_seq);
+	return ret;
+}
+
 static int ssd1322_init(struct ssd1322fb_par *par)
 {
+	struct spi_transfer xfer = {
+		.tx_buf = par->init_buf,
+		.len = par->init_len,
+		.bits_per_word = par->bits_per_word,
+		.speed_hz = READ_ONCE(par->cmd_speed_hz),
+	};
+	u8 band[2];
+	int ret;
+
+	// A single transfer takes the bus lock and CS once for the whole
+	// sequence
+	trace_ssd1322fb_cmds(par, par->init_cmd, par->init_words,
+			     par->init_len);
+	ret = spi_sync_transfer(par->spi, &xfer, 1);
+	if (ret) {
+		dev_err(&par->spi->dev, "Failed to initialize SSD1322: %d\n",
+			ret);
+		return ret;
+	}
+
+	// The sequence selects the default table, a custom one is sent again
+	if (par->gray_custom) {
+		mutex_lock(&par->cmd_lock);
+		ret = ssd1322_load_gray_table(par);
+		mutex_unlock(&par->cmd_lock);
+		if (ret)
+			return ret;
+	}
+
+	// Same for the partial display band
+	if (par->partial_height) {
+		band[0] = par->partial_y;
+		band[1] = par->partial_y + par->partial_height - 1;
+		ret = ssd1322_cmd(par, SSD1322_CMD_ENTER_PARTIAL_DISPLAY, band,
+				  sizeof(band));
+		if (ret)
+			return ret;
+	}
+
+	dev_info(&par->spi->dev, "ssd1322fb oled init done.\n");
+	return 0;
+}
+
+static ssize_t ssd1322fb_read(struct fb_info *info, char __user *buf,
+			       size_t count, loff_t *ppos)
+{
+	char *src;
+
+	// Check if the position is valid
+	if (*ppos >= info->fix.smem_len)
+		return 0; // No more data to read
+
+	// Adjust count if it goes beyond the end of the buffer
+	if (*ppos + count > info->fix.smem_len)
+		count = info->fix.smem_len - *ppos;
+
+	// Point to the framebuffer memory
+	src = (char *)info->screen_base + *ppos;
+
+	// Copy framebuffer memory to user-space buffer
+	if (copy_to_user(buf, src, count))
+		return -EFAULT;
+
+	// Update the position pointer
+	*ppos += count;
+
+	return count; // Return the number of bytes read
+}
+
+// Function that is called when data is written to the fb
+static ssize_t ssd1322fb_write(struct fb_info *info, const char __user *buf,
+				size_t count, loff_t *ppos)
+{
+	struct ssd1322fb_par *par;
+	char *dst;
+
+	// Initializing variables
+	par = info->par;
+	dst = (char *)info->screen_base + *ppos;
+
+	// Check for overflow and adjust count if necessary
+	if (*ppos >= info->fix.smem_len) {
+		dev_err(&par->spi->dev,
+			"Framebuffer write error: ppos (%llu) is beyond the framebuffer size (%u)\n",
+			*ppos, info->fix.smem_len);
+		return -ENOSPC; // No space left in the framebuffer
+	}
+
+	if (*ppos + count > info->fix.smem_len) {
+		dev_info(
+			&par->spi->dev,
+			"Framebuffer write adjustment: ppos (%llu) + count (%zu) exceeds framebuffer size (%u)\n",
+			*ppos, count, info->fix.smem_len);
+		count = info->fix.smem_len - *ppos;
+	}
+
+	// Copy data from user space to framebuffer memory
+	if (copy_from_user(dst, buf, count)) {
+		return -EFAULT;
+	}
+
+	// Only the written bytes need to be sent
+	ssd1322fb_damage_range(par, *ppos, count);
+
+	// Update the position pointer
+	*ppos += count;
+
+	// Trigger display update here, the caller never waits for the bus
+	ssd1322fb_schedule_flush(par);
+
+	return count; // Return the number of bytes written
+}
+
+static void ssd1322fb_damage(struct ssd1322fb_par *par, u32 x, u32 y, u32 w,
+			     u32 h)
+{
+	struct fb_info *info = par->info;
+	struct ssd1322fb_rect *d = &par->damage;
+	unsigned long flags;
+	u32 x2, y2;
+
+	// Clip to the visible area
+	if (x >= info->var.xres || y >= info->var.yres || !w || !h)
+		return;
+	x2 = min(x + w, info->var.xres);
+	y2 = min(y + h, info->var.yres);
+
+	spin_lock_irqsave(&par->damage_lock, flags);
+	par->damage_seq++;
+	if (d->x1 >= d->x2 || d->y1 >= d->y2) {
+		par->damage_start = ktime_get();
+		d->x1 = x;
+		d->y1 = y;
+		d->x2 = x2;
+		d->y2 = y2;
+	} else {
+		d->x1 = min(d->x1, x);
+		d->y1 = min(d->y1, y);
+		d->x2 = max(d->x2, x2);
+		d->y2 = max(d->y2, y2);
+	}
+	trace_ssd1322fb_damage(par, x, y, x2, y2);
+	spin_unlock_irqrestore(&par->damage_lock, flags);
+}
+
+static void ssd1322fb_damage_area(struct ssd1322fb_par *par, u32 x, u32 y,
+				  u32 w, u32 h)
+{
+	u32 yres_virtual = par->info->var.yres_virtual;
+	u32 yres = par->info->var.yres;
+	u32 rel;
+
+	if (y >= yres_virtual || !h)
+		return;
+	h = min(h, yres_virtual - y);
+
+	// Rows counted from the top of the screen. With ywrap panning the
+	// screen continues at the start of the framebuffer memory. Rows that
+	// are not displayed are picked up by the shadow diff when they are
+	// panned in.
+	rel = (y + yres_virtual - READ_ONCE(par->yoffset)) % yres_virtual;
+	if (rel < yres)
+		ssd1322fb_damage(par, x, rel, w, h);
+	if (rel + h > yres_virtual)
+		ssd1322fb_damage(par, x, 0, w, rel + h - yres_virtual);
+}
+
+static void ssd1322fb_damage_range(struct ssd1322fb_par *par, size_t offset,
+				   size_t len)
+{
+	u32 line_length = READ_ONCE(par->info->fix.line_length);
+	u32 bpp = READ_ONCE(par->bpp);
+	u32 first_row, last_row;
+	u32 x1, x2;
+
+	if (!len)
+		return;
+
+	first_row = offset / line_length;
+	last_row = (offset + len - 1) / line_length;
+
+	// A range within one row only damages the bytes it covers
+	if (first_row == last_row) {
+		x1 = (offset % line_length) * 8 / bpp;
+		x2 = ((offset + len - 1) % line_length + 1) * 8 / bpp;
+		ssd1322fb_damage_area(par, x1, first_row, x2 - x1, 1);
+	} else {
+		ssd1322fb_damage_area(par, 0, first_row, par->info->var.xres,
+				      last_row - first_row + 1);
+	}
+}
+
+static void ssd1322fb_scroll_locked(struct ssd1322fb_par *par, int rows)
+{
+	struct ssd1322fb_rect *d = &par->damage;
+	int yres = par->info->var.yres;
+	int y1, y2;
+
+	lockdep_assert_held(&par->damage_lock);
+
+	// Pending damage moves along with the screen contents
+	if (d->x1 < d->x2 && d->y1 < d->y2) {
+		y1 = clamp((int)d->y1 - rows, 0, yres);
+		y2 = clamp((int)d->y2 - rows, 0, yres);
+		if (y1 < y2) {
+			d->y1 = y1;
+			d->y2 = y2;
+		} else {
+			memset(d, 0, sizeof(*d));
+		}
+	}
+
+	par->scroll += rows;
+	par->damage_seq++;
+}
+
+static void ssd1322fb_apply_scroll(struct ssd1322fb_par *par, int rows,
+				   struct ssd1322fb_rect *rect)
+{
+	u32 line_length = par->pitch;
+	u32 yres = par->info->var.yres;
+	u32 n = abs(rows);
+	u32 y1, y2;
+
+	if (n >= yres) {
+		// Nothing on the panel is reused
+		bitmap_fill(par->shadow_stale, yres);
+		y1 = 0;
+		y2 = yres;
+	} else {
+		// The shadow follows the rows the start line moves, only the
+		// rows scrolled in are unknown
+		if (rows > 0) {
+			memmove(par->shadow, par->shadow + n * line_length,
+				(yres - n) * line_length);
+			bitmap_shift_right(par->shadow_stale, par->shadow_stale,
+					   n, yres);
+			y1 = yres - n;
+			y2 = yres;
+		} else {
+			memmove(par->shadow + n * line_length, par->shadow,
+				(yres - n) * line_length);
+			bitmap_shift_left(par->shadow_stale, par->shadow_stale,
+					  n, yres);
+			y1 = 0;
+			y2 = n;
+		}
+		bitmap_set(par->shadow_stale, y1, n);
+
+		par->start_line = (par->start_line + SSD1322_GDDRAM_ROWS +
+				   rows % SSD1322_GDDRAM_ROWS) %
+				  SSD1322_GDDRAM_ROWS;
+		par->start_line_dirty = true;
+	}
+
+	// The exposed rows go out with this frame
+	if (rect->x1 >= rect->x2 || rect->y1 >= rect->y2) {
+		rect->y1 = y1;
+		rect->y2 = y2;
+	} else {
+		rect->y1 = min(rect->y1, y1);
+		rect->y2 = max(rect->y2, y2);
+	}
+	rect->x1 = 0;
+	rect->x2 = par->info->var.xres;
+}
+
+static const u8 *ssd1322fb_scanout_row(struct ssd1322fb_par *par, u32 y)
+{
+	struct fb_info *info = par->info;
+
+	// A burn-in run shows its test pattern instead of the framebuffer
+	if (par->burn_in)
+		return par->burn_in + y * par->pitch;
+
+	// So does a playing animation, at the frame taken with the damage
+	if (par->scan_anim)
+		return par->scan_anim + y * par->pitch;
+
+	// Other formats are converted into the gray buffer first
+	if (par->bpp != 4)
+		return par->gray + y * par->pitch;
+
+	return par->buf + (par->scan_yoffset + y) % info->var.yres_virtual *
+				  info->fix.line_length;
+}
+
+static u32 ssd1322fb_gddram_row(struct ssd1322fb_par *par, u32 y)
+{
+	return (par->start_line + y) % SSD1322_GDDRAM_ROWS;
+}
+
+// Sequence numbers wrap, compare them by distance
+static bool ssd1322fb_seq_before(unsigned long a, unsigned long b)
+{
+	return (long)(a - b) < 0;
+}
+
+// Cost in 9-bit words of sending a window of the given size
+static unsigned int ssd1322fb_window_cost(struct ssd1322fb_par *par,
+					  u32 width, u32 height)
+{
+	return SSD1322_WINDOW_COST + width / par->pixels_per_col * height *
+					     SSD1322_WORDS_PER_COL;
+}
+
+// Inlined with constant geometries by the wrappers below
+static __always_inline int __ssd1322fb_diff_row(struct ssd1322fb_par *par,
+						u32 y, u32 x1, u32 x2,
+						struct ssd1322fb_rect *spans,
+						int max_spans, u32 width,
+						u32 pixels_per_col)
+{
+	u32 line_length = par->pitch;
+	const u8 *src = ssd1322fb_scanout_row(par, y);
+	const u8 *shadow = par->shadow + y * line_length;
+	int nspans = 0;
+	u32 x;
+
+	// Nothing is known about a stale row, so all of it is sent
+	if (test_bit(y, par->shadow_stale)) {
+		spans[0].x1 = 0;
+		spans[0].y1 = y;
+		spans[0].x2 = width;
+		spans[0].y2 = y + 1;
+		return 1;
+	}
+
+	if (!memcmp(src + x1 / 2, shadow + x1 / 2, (x2 - x1) / 2))
+		return 0;
+
+	for (x = x1; x < x2; x += pixels_per_col) {
+		u32 gap_words;
+
+		if (!memcmp(src + x / 2, shadow + x / 2, pixels_per_col / 2))
+			continue;
+
+		// Resending a short unchanged gap is cheaper than a new window
+		if (nspans) {
+			gap_words = (x - spans[nspans - 1].x2) /
+				    pixels_per_col * SSD1322_WORDS_PER_COL;
+			if (gap_words <= SSD1322_WINDOW_COST ||
+			    nspans == max_spans) {
+				spans[nspans - 1].x2 = x + pixels_per_col;
+				continue;
+			}
+		}
+
+		spans[nspans].x1 = x;
+		spans[nspans].y1 = y;
+		spans[nspans].x2 = x + pixels_per_col;
+		spans[nspans].y2 = y + 1;
+		nspans++;
+	}
+
+	return nspans;
+}
+
+static int ssd1322fb_diff_row_128x64(struct ssd1322fb_par *par, u32 y, u32 x1,
+				     u32 x2, struct ssd1322fb_rect *spans,
+				     int max_spans)
+{
+	return __ssd1322fb_diff_row(par, y, x1, x2, spans, max_spans, 128,
+				    SSD1322_PIXELS_PER_COL_DUP);
+}
+
+static int ssd1322fb_diff_row_256x64(struct ssd1322fb_par *par, u32 y, u32 x1,
+				     u32 x2, struct ssd1322fb_rect *spans,
+				     int max_spans)
+{
+	return __ssd1322fb_diff_row(par, y, x1, x2, spans, max_spans, 256,
+				    SSD1322_PIXELS_PER_COL_NATIVE);
+}
+
+static int ssd1322fb_diff_row_any(struct ssd1322fb_par *par, u32 y, u32 x1,
+				  u32 x2, struct ssd1322fb_rect *spans,
+				  int max_spans)
+{
+	return __ssd1322fb_diff_row(par, y, x1, x2, spans, max_spans,
+				    par->width, par->pixels_per_col);
+}
+
+static int ssd1322fb_read_geometry(struct ssd1322fb_par *par)
+{
+	struct device *dev = &par->spi->dev;
+
+	if (device_property_read_u32(dev, "ssd,width", &par->width))
+		par->width = SSD1322_WIDTH;
+	if (device_property_read_u32(dev, "ssd,height", &par->height))
+		par->height = SSD1322_HEIGHT;
+	if (device_property_read_u32(dev, "ssd,col-offset", &par->col_start))
+		par->col_start = SSD1322_COL_START;
+	// Panels wired to every segment take two pixels per GDDRAM byte
+	par->dup = !device_property_read_bool(dev, "ssd,native-pixels");
+	par->pixels_per_col = par->dup ? SSD1322_PIXELS_PER_COL_DUP :
+					 SSD1322_PIXELS_PER_COL_NATIVE;
+	if (device_property_read_u32(dev, "width-mm", &par->width_mm))
+		par->width_mm = SSD1322_WIDTH_MM;
+	if (device_property_read_u32(dev, "height-mm", &par->height_mm))
+		par->height_mm = SSD1322_HEIGHT_MM;
+
+	// Whole bytes of the 1 bit format and whole column addresses
+	if (par->width < 8 || par->width % 8 || par->height < 1 ||
+	    par->height > SSD1322_MAX_HEIGHT ||
+	    par->col_start + par->width / par->pixels_per_col >
+		    SSD1322_GDDRAM_COLS) {
+		dev_err(dev, "Panel of %ux%u at column %u does not fit GDDRAM\n",
+			par->width, par->height, par->col_start);
+		return -EINVAL;
+	}
+
+	// The common panels get a diff with the row layout known at compile
+	// time
+	if (par->dup && par->width == 128 && par->height == 64)
+		par->diff_row = ssd1322fb_diff_row_128x64;
+	else if (!par->dup && par->width == 256 && par->height == 64)
+		par->diff_row = ssd1322fb_diff_row_256x64;
+	else
+		par->diff_row = ssd1322fb_diff_row_any;
+
+	return 0;
+}
+
+static void ssd1322fb_add_window(struct ssd1322fb_rect *windows, int *nwindows,
+				 const struct ssd1322fb_rect *rect)
+{
+	struct ssd1322fb_rect *last;
+
+	if (*nwindows < SSD1322_MAX_WINDOWS) {
+		windows[(*nwindows)++] = *rect;
+		return;
+	}
+
+	// Out of windows, grow the last one to cover the rest
+	last = &windows[SSD1322_MAX_WINDOWS - 1];
+	last->x1 = min(last->x1, rect->x1);
+	last->y1 = min(last->y1, rect->y1);
+	last->x2 = max(last->x2, rect->x2);
+	last->y2 = max(last->y2, rect->y2);
+}
+
+static int ssd1322fb_plan_windows(struct ssd1322fb_par *par,
+				  const struct ssd1322fb_rect *rect,
+				  struct ssd1322fb_rect *windows)
+{
+	struct ssd1322fb_rect spans[SSD1322_MAX_SPANS];
+	struct ssd1322fb_rect band;
+	unsigned int merged, separate;
+	int nwindows = 0;
+	int nspans, i;
+	u32 x1, x2, y;
+
+	memset(&band, 0, sizeof(band));
+
+	for (y = rect->y1; y < rect->y2; y++) {
+		nspans = par->diff_row(par, y, rect->x1, rect->x2, spans,
+				       SSD1322_MAX_SPANS);
+		// Windows cannot wrap around the end of GDDRAM
+		if (!ssd1322fb_gddram_row(par, y) && band.x1 < band.x2) {
+			ssd1322fb_add_window(windows, &nwindows, &band);
+			memset(&band, 0, sizeof(band));
+		}
+
+		if (!nspans) {
+			// An unchanged row ends the current band
+			if (band.x1 < band.x2)
+				ssd1322fb_add_window(windows, &nwindows, &band);
+			memset(&band, 0, sizeof(band));
+			continue;
+		}
+
+		if (band.x1 < band.x2) {
+			// Grow the band over this row if that beats new windows
+			x1 = min(band.x1, spans[0].x1);
+			x2 = max(band.x2, spans[nspans - 1].x2);
+			merged = ssd1322fb_window_cost(par, x2 - x1,
+						       band.y2 - band.y1 + 1);
+			separate = ssd1322fb_window_cost(par, band.x2 - band.x1,
+							 band.y2 - band.y1);
+			for (i = 0; i < nspans; i++)
+				separate += ssd1322fb_window_cost(
+					par, spans[i].x2 - spans[i].x1, 1);
+
+			if (merged <= separate) {
+				band.x1 = x1;
+				band.x2 = x2;
+				band.y2 = y + 1;
+				continue;
+			}
+
+			ssd1322fb_add_window(windows, &nwindows, &band);
+		}
+
+		// The last span of the row may still grow into the next rows
+		for (i = 0; i < nspans - 1; i++)
+			ssd1322fb_add_window(windows, &nwindows, &spans[i]);
+		band = spans[nspans - 1];
+	}
+
+	if (band.x1 < band.x2)
+		ssd1322fb_add_window(windows, &nwindows, &band);
+
+	return nwindows;
+}
+
+static size_t ssd1322fb_window_len(struct ssd1322fb_par *par,
+				   const struct ssd1322fb_rect *rect)
+{
+	size_t words = (rect->x2 - rect->x1) / par->pixels_per_col *
+		       (rect->y2 - rect->y1) * SSD1322_WORDS_PER_COL;
+
+	if (par->native_9bit)
+		return words * sizeof(u16);
+	return DIV_ROUND_UP(words * 9, 8);
+}
+
+static size_t ssd1322fb_encode_window(struct ssd1322fb_par *par,
+				      const struct ssd1322fb_rect *rect,
+				      u8 *header, u8 *data)
+{
+	u32 line_length = par->pitch;
+	u16 words[SSD1322_WINDOW_COST];
+	struct ssd1322_enc enc;
+	u32 width = rect->x2 - rect->x1;
+	u32 y;
+
+	// Column, row and write RAM commands go out as one burst
+	words[0] = SSD1322_CMD_SET_COLUMN_ADDR;
+	words[1] = 0x100 | (par->col_start + rect->x1 / par->pixels_per_col);
+	words[2] = 0x100 | (par->col_start + rect->x2 / par->pixels_per_col - 1);
+	words[3] = SSD1322_CMD_SET_ROW_ADDR;
+	words[4] = 0x100 | ssd1322fb_gddram_row(par, rect->y1);
+	words[5] = 0x100 | ssd1322fb_gddram_row(par, rect->y2 - 1);
+	words[6] = SSD1322_CMD_WRITE_RAM;
+	if (par->native_9bit)
+		memcpy(header, words, sizeof(words));
+	else
+		ssd1322_pack9_words(header, words, SSD1322_WINDOW_COST);
+
+	// The shadow holds exactly what is sent, even if mmap users keep
+	// drawing into the framebuffer meanwhile
+	for (y = rect->y1; y < rect->y2; y++) {
+		memcpy(par->shadow + y * line_length + rect->x1 / 2,
+		       ssd1322fb_scanout_row(par, y) + rect->x1 / 2,
+		       width / 2);
+		clear_bit(y, par->shadow_stale);
+	}
+
+	// Duplicate each nibble and pack the 9-bit words in a single pass.
+	// Rows are contiguous in GDDRAM, so the stream carries over between
+	// them.
+	ssd1322_enc_init(&enc, data, par->native_9bit, par->dup);
+	for (y = rect->y1; y < rect->y2; y++)
+		ssd1322_enc_span(&enc,
+				 par->shadow + y * line_length + rect->x1 / 2,
+				 width / 2);
+
+	return ssd1322_enc_finish(&enc);
+}
+
+static void ssd1322fb_hist_add(u32 *hist, u64 ns)
+{
+	u64 us = div_u64(ns, NSEC_PER_USEC);
+
+	hist[min_t(u32, fls64(us), SSD1322_HIST_BUCKETS - 1)]++;
+}
+
+static void ssd1322fb_frame_complete(void *context)
+{
+	struct ssd1322fb_frame *frame = context;
+	struct ssd1322fb_par *par = frame->par;
+	ktime_t now = ktime_get();
+	unsigned long flags;
+	unsigned long seq;
+
+	trace_ssd1322fb_frame_done(par, frame);
+	par->stats.bytes_on_wire += frame->msg.actual_length;
+	par->stats.transfer_ns += ktime_to_ns(ktime_sub(now,
+							frame->submit_time));
+	ssd1322fb_hist_add(par->stats.transfer_hist,
+			   ktime_to_ns(ktime_sub(now, frame->submit_time)));
+	if (frame->damage_time)
+		ssd1322fb_hist_add(par->stats.latency_hist,
+				   ktime_to_ns(ktime_sub(now,
+							 frame->damage_time)));
+
+	if (frame->msg.status) {
+		dev_err_ratelimited(&par->spi->dev,
+				    "SPI transfer for frame failed: %d\n",
+				    frame->msg.status);
+		par->stats.transfer_errors++;
+
+		// The panel is in an unknown state wherever the frame went, and
+		// scrolls since it was encoded may have moved those rows. The
+		// next update resends everything.
+		WRITE_ONCE(par->resync, true);
+		ssd1322fb_damage(par, 0, 0, par->info->var.xres,
+				 par->info->var.yres);
+	}
+
+	// The idle timeout starts over after the last frame
+	pm_runtime_mark_last_busy(&par->spi->dev);
+	pm_runtime_put_autosuspend(&par->spi->dev);
+
+	// Frames complete in order, so everything damaged before this one,
+	// and anything skipped as identical meanwhile, is on the panel now
+	spin_lock_irqsave(&par->damage_lock, flags);
+	seq = frame->seq;
+	if (ssd1322fb_seq_before(seq, par->skip_seq))
+		seq = par->skip_seq;
+	// Waiters for any of that damage see the error, however many frames
+	// complete before they wake up
+	if (frame->msg.status) {
+		par->err_from = par->done_seq;
+		par->err_seq = seq;
+	}
+	par->done_seq = seq;
+
+	// Damage or scrolling that arrived during the transfer goes out with
+	// the next frame. After an error the retry waits for the next update.
+	// Teardown sets stopping under this lock before cancelling the work.
+	if (!frame->msg.status && !par->stopping &&
+	    ((par->damage.x1 < par->damage.x2 &&
+	      par->damage.y1 < par->damage.y2) || par->scroll))
+		kthread_queue_delayed_work(par->kworker, &par->flush_work,
+					   ssd1322fb_flush_delay(par, 0));
+	clear_bit(frame->index, &par->frames_busy);
+	spin_unlock_irqrestore(&par->damage_lock, flags);
+	wake_up_all(&par->frame_wq);
+
+	// Teardown may free the device as soon as this is signalled
+	complete_all(&frame->done);
+}
+
+static void ssd1322fb_stop(struct ssd1322fb_par *par)
+{
+	unsigned long flags;
+	int i;
+
+	// No completion can requeue the flush once this is seen
+	spin_lock_irqsave(&par->damage_lock, flags);
+	par->stopping = true;
+	spin_unlock_irqrestore(&par->damage_lock, flags);
+
+	kthread_cancel_delayed_work_sync(&par->flush_work);
+	for (i = 0; i < ARRAY_SIZE(par->frames); i++)
+		wait_for_completion(&par->frames[i].done);
+}
+
+static inline u8 ssd1322_xrgb_gray4(u32 xrgb)
+{
+	u32 r = (xrgb >> 16) & 0xFF;
+	u32 g = (xrgb >> 8) & 0xFF;
+	u32 b = xrgb & 0xFF;
+
+	// BT.601 luma, reduced to 4 bits
+	return (r * 77 + g * 151 + b * 28) >> 12;
+}
+
+static inline u8 ssd1322_rgb565_gray4(u16 rgb)
+{
+	u32 r = rgb >> 11;
+	u32 g = (rgb >> 5) & 0x3F;
+	u32 b = rgb & 0x1F;
+
+	// Same weights, scaled for 5 and 6 bit channels
+	return (r * 616 + g * 604 + b * 224) >> 12;
+}
+
+static void ssd1322_conv_mono(u8 *dst, const u8 *src, u32 x, u32 n)
+{
+	static const u8 pair[4] = { 0x00, 0x0F, 0xF0, 0xFF };
+	u32 i;
+
+	// Two bits, MSB first, to two nibbles
+	for (i = 0; i < n; i++, x += 2)
+		dst[i] = pair[(src[x / 8] >> (6 - x % 8)) & 3];
+}
+
+static void ssd1322_conv_gray8(u8 *dst, const u8 *src, u32 x, u32 n)
+{
+	__le64 raw;
+	__le32 out;
+	u64 v, lo;
+	u32 i;
+
+	src += x;
+
+	// Eight pixels a time: keep the upper nibble of each byte and fold
+	// every pair into one byte
+	for (i = 0; i + 4 <= n; i += 4, src += 8) {
+		memcpy(&raw, src, sizeof(raw));
+		v = le64_to_cpu(raw);
+		lo = (v & 0x00F000F000F000F0ULL) |
+		     ((v >> 12) & 0x000F000F000F000FULL);
+		lo = (lo | lo >> 8) & 0x0000FFFF0000FFFFULL;
+		out = cpu_to_le32((u32)(lo | lo >> 16));
+		memcpy(dst + i, &out, sizeof(out));
+	}
+
+	for (; i < n; i++, src += 2)
+		dst[i] = (src[0] & 0xF0) | (src[1] >> 4);
+}
+
+static void ssd1322_conv_rgb565(u8 *dst, const u8 *src, u32 x, u32 n)
+{
+	const u16 *p = (const u16 *)src + x;
+	u32 i;
+
+	for (i = 0; i < n; i++, p += 2)
+		dst[i] = ssd1322_rgb565_gray4(p[0]) << 4 |
+			 ssd1322_rgb565_gray4(p[1]);
+}
+
+static void ssd1322_conv_xrgb8888(u8 *dst, const u8 *src, u32 x, u32 n)
+{
+	const u32 *p = (const u32 *)src + x;
+	u32 i;
+
+	for (i = 0; i < n; i++, p += 2)
+		dst[i] = ssd1322_xrgb_gray4(p[0]) << 4 |
+			 ssd1322_xrgb_gray4(p[1]);
+}
+
+static void ssd1322fb_convert(struct ssd1322fb_par *par,
+			      const struct ssd1322fb_rect *rect)
+{
+	struct fb_info *info = par->info;
+	u32 yres_virtual = info->var.yres_virtual;
+	u32 line_length = info->fix.line_length;
+	void (*conv)(u8 *dst, const u8 *src, u32 x, u32 n);
+	const u8 *src;
+	u32 x1, x2, y;
+
+	switch (par->bpp) {
+	case 1:
+		conv = ssd1322_conv_mono;
+		break;
+	case 8:
+		conv = ssd1322_conv_gray8;
+		break;
+	case 16:
+		conv = ssd1322_conv_rgb565;
+		break;
+	default:
+		conv = ssd1322_conv_xrgb8888;
+		break;
+	}
+
+	for (y = rect->y1; y < rect->y2; y++) {
+		src = par->buf + (par->scan_yoffset + y) % yres_virtual *
+					 line_length;
+
+		// Stale rows are sent whole, so they are converted whole
+		x1 = test_bit(y, par->shadow_stale) ? 0 : rect->x1;
+		x2 = test_bit(y, par->shadow_stale) ? info->var.xres : rect->x2;
+		conv(par->gray + y * par->pitch + x1 / 2, src, x1,
+		     (x2 - x1) / 2);
+	}
+}
+
+static void ssd1322fb_add_chunks(struct ssd1322fb_par *par,
+				 struct ssd1322fb_frame *frame,
+				 struct spi_transfer **xfer, const u8 *buf,
+				 size_t len, u32 speed_hz, bool cs_change)
+{
+	struct spi_transfer *t = *xfer;
+	size_t chunk;
+
+	do {
+		chunk = min(len, par->max_chunk);
+		len -= chunk;
+		t->tx_buf = buf;
+		t->len = chunk;
+		t->bits_per_word = par->bits_per_word;
+		t->speed_hz = speed_hz;
+		t->cs_change = !len && cs_change;
+		spi_message_add_tail(t, &frame->msg);
+		trace_ssd1322fb_chunk(par, frame, t);
+		buf += chunk;
+		t++;
+	} while (len);
+
+	*xfer = t;
+}
+
+static int ssd1322fb_update_display(struct ssd1322fb_par *par)
+{
+	struct ssd1322fb_frame *frame;
+	struct ssd1322fb_rect *windows;
+	struct spi_transfer *xfer;
+	struct ssd1322fb_rect rect;
+	unsigned long flags;
+	u32 cmd_speed_hz, pixel_speed_hz;
+	ktime_t start;
+	u64 encode_ns;
+	size_t header_len;
+	size_t data_len;
+	size_t msg_len;
+	size_t bytes;
+	size_t len;
+	bool resync;
+	int nwindows;
+	u8 *header;
+	u8 *data;
+	u32 wrap;
+	u8 line;
+	int scroll;
 	int ret;
+	int i, k;
+
+	mutex_lock(&par->lock);
+
+	// Encode into the idle frame. If the previous frame is still on the
+	// bus the damage keeps accumulating until its completion requeues
+	// the flush, so back-to-back updates collapse into one.
+	frame = &par->frames[par->next_frame];
+	ret = 0;
+	if (test_bit(frame->index, &par->frames_busy))
+		goto out_unlock;
+
+	// Wake the panel if it went to sleep. Each frame holds a reference
+	// until it completes.
+	ret = pm_runtime_resume_and_get(&par->spi->dev);
+	if (ret < 0) {
+		dev_err_ratelimited(&par->spi->dev,
+				    "Failed to wake the panel: %d\n", ret);
+		goto out_unlock;
+	}
+
+	// Take the damage and scrolling accumulated since the last update
+	spin_lock_irqsave(&par->damage_lock, flags);
+	rect = par->damage;
+	memset(&par->damage, 0, sizeof(par->damage));
+	scroll = par->scroll;
+	par->scroll = 0;
+	resync = par->resync;
+	par->resync = false;
+	frame->seq = par->damage_seq;
+	frame->damage_time = rect.x1 < rect.x2 ? par->damage_start : 0;
+	par->scan_yoffset = par->yoffset;
+	par->scan_anim = par->anim_show;
+	spin_unlock_irqrestore(&par->damage_lock, flags);
+	start = ktime_get();
+
+	if (resync) {
+		bitmap_fill(par->shadow_stale, par->info->var.yres);
+		par->start_line_dirty = true;
+	}
+	if (scroll)
+		ssd1322fb_apply_scroll(par, scroll, &rect);
+	trace_ssd1322fb_flush_start(par, &rect, frame->seq);
+
+	if ((rect.x1 >= rect.x2 || rect.y1 >= rect.y2) &&
+	    !par->start_line_dirty)
+		goto out_put; // Nothing changed
+
+	// Rows outside the partial display band are dark, they catch up when
+	// the band is left
+	if (par->partial_height) {
+		rect.y1 = max(rect.y1, par->partial_y);
+		rect.y2 = min(rect.y2, par->partial_y + par->partial_height);
+	}
+
+	// The controller addresses columns in units of 4 GDDRAM pixels
+	rect.x1 = round_down(rect.x1, par->pixels_per_col);
+	rect.x2 = round_up(rect.x2, par->pixels_per_col);
+
+	// Formats other than the panel's are converted where damaged
+	if (par->bpp != 4 && rect.x1 < rect.x2 && rect.y1 < rect.y2)
+		ssd1322fb_convert(par, &rect);
+
+	// Only the parts that differ from the panel contents are sent
+	windows = frame->windows;
+	nwindows = 0;
+	if (rect.x1 < rect.x2 && rect.y1 < rect.y2)
+		nwindows = ssd1322fb_plan_windows(par, &rect, windows);
+	if (!nwindows && !par->start_line_dirty) {
+		// Done as soon as the frame still on the bus, if any, is
+		spin_lock_irqsave(&par->damage_lock, flags);
+		if (par->frames_busy)
+			par->skip_seq = frame->seq;
+		else
+			par->done_seq = frame->seq;
+		spin_unlock_irqrestore(&par->damage_lock, flags);
+		wake_up_all(&par->frame_wq);
+
+		par->stats.frames_skipped++;
+		goto out_put;
+	}
+
+	// Merged windows may overlap, fall back to their bounding box if
+	// they no longer fit the frame
+	data_len = 0;
+	for (i = 0; i < nwindows; i++)
+		data_len += ssd1322fb_window_len(par, &windows[i]);
+	if (data_len > par->tx_buf_len) {
+		for (i = 1; i < nwindows; i++) {
+			windows[0].x1 = min(windows[0].x1, windows[i].x1);
+			windows[0].y1 = min(windows[0].y1, windows[i].y1);
+			windows[0].x2 = max(windows[0].x2, windows[i].x2);
+			windows[0].y2 = max(windows[0].y2, windows[i].y2);
+		}
+		nwindows = 1;
+	}
+
+	// Bands are split where GDDRAM wraps, so only the grown last window
+	// or the bounding box can cross it. That one is sent in two parts.
+	wrap = SSD1322_GDDRAM_ROWS - par->start_line;
+	for (i = 0; i < nwindows; i++) {
+		if (windows[i].y1 < wrap && windows[i].y2 > wrap) {
+			windows[nwindows] = windows[i];
+			windows[nwindows].y1 = wrap;
+			windows[i].y2 = wrap;
+			nwindows++;
+			break;
+		}
+	}
+
+	// Controllers limiting the message size get the frame in several
+	// messages. Rows that do not fit go out with the next frame, which
+	// takes over the damage sequence.
+	header_len = par->native_9bit ? SSD1322_WINDOW_COST * sizeof(u16) :
+					DIV_ROUND_UP(SSD1322_WINDOW_COST * 9, 8);
+	msg_len = par->start_line_dirty ? SSD1322_WINDOW_HEADER_LEN : 0;
+	for (i = 0; i < nwindows; i++) {
+		struct ssd1322fb_rect row = windows[i];
+		size_t row_len, room;
+		u32 rows;
+
+		row.y2 = row.y1 + 1;
+		row_len = ssd1322fb_window_len(par, &row);
+		room = par->max_msg - min(par->max_msg, msg_len + header_len);
+		rows = min_t(size_t, room / row_len,
+			     windows[i].y2 - windows[i].y1);
+		if (rows < windows[i].y2 - windows[i].y1) {
+			for (k = i; k < nwindows; k++) {
+				u32 y1 = k == i ? windows[k].y1 + rows :
+						  windows[k].y1;
+
+				ssd1322fb_damage(par, windows[k].x1, y1,
+						 windows[k].x2 - windows[k].x1,
+						 windows[k].y2 - y1);
+			}
+			windows[i].y2 = windows[i].y1 + rows;
+			nwindows = rows ? i + 1 : i;
+			frame->seq = par->frames[frame->index ^ 1].seq;
+			par->stats.frames_split++;
+			break;
+		}
+		msg_len += header_len + rows * row_len;
+	}
+	frame->nwindows = nwindows;
+
+	// An empty message would be rejected by the SPI core. The rows were
+	// damaged again above, the next frame starts with them.
+	if (!nwindows && !par->start_line_dirty)
+		goto out_put;
+
+	// Commands go at the conservative clock, WRITE_RAM streams at the
+	// pixel clock
+	cmd_speed_hz = READ_ONCE(par->cmd_speed_hz);
+	pixel_speed_hz = READ_ONCE(par->pixel_speed_hz);
+	memset(frame->xfers, 0, frame->nxfers * sizeof(*frame->xfers));
+	spi_message_init(&frame->msg);
+	header = frame->buf;
+	data = frame->buf + SSD1322_FRAME_HEADER_LEN;
+	xfer = frame->xfers;
+
+	// A scroll moves the start line ahead of the rows it exposes
+	bytes = 0;
+	if (par->start_line_dirty) {
+		line = par->start_line;
+		len = ssd1322_encode_cmd(par, header, SSD1322_CMD_SET_START_LINE,
+					 &line, 1);
+		ssd1322fb_add_chunks(par, frame, &xfer, header, len,
+				     cmd_speed_hz, nwindows > 0);
+		bytes += len;
+		header += SSD1322_WINDOW_HEADER_LEN;
+		par->start_line_dirty = false;
+	}
+
+	// Each window is a command burst followed by its pixel stream, with
+	// CS toggled in between so the stream starts on a word boundary
+	for (i = 0; i < nwindows; i++) {
+		data = PTR_ALIGN(data, SSD1322_CHUNK_ALIGN);
+		len = ssd1322fb_encode_window(par, &windows[i], header, data);
+		ssd1322fb_add_chunks(par, frame, &xfer, header, header_len,
+				     cmd_speed_hz, true);
+		ssd1322fb_add_chunks(par, frame, &xfer, data, len,
+				     pixel_speed_hz, i < nwindows - 1);
+		bytes += header_len + len;
+
+		header += SSD1322_WINDOW_HEADER_LEN;
+		data += len;
+	}
+
+	frame->msg.complete = ssd1322fb_frame_complete;
+	frame->msg.context = frame;
+	frame->submit_time = ktime_get();
+	encode_ns = ktime_to_ns(ktime_sub(frame->submit_time, start));
+	par->stats.encode_ns += encode_ns;
+	ssd1322fb_hist_add(par->stats.encode_hist, encode_ns);
+	trace_ssd1322fb_encode_done(par, frame, bytes, encode_ns);
+	reinit_completion(&frame->done);
+	set_bit(frame->index, &par->frames_busy);
+	if (READ_ONCE(par->bus_lock)) {
+		// Other devices on the bus wait until the whole frame is out,
+		// so it goes over the wire as one burst
+		spi_bus_lock(par->spi->controller);
+		frame->msg.status = spi_sync_locked(par->spi, &frame->msg);
+		spi_bus_unlock(par->spi->controller);
+		ssd1322fb_frame_complete(frame);
+		ret = frame->msg.status;
+		if (ret)
+			goto out_unlock;
+	} else {
+		ret = spi_async(par->spi, &frame->msg);
+		if (ret) {
+			dev_err(&par->spi->dev, "Failed to queue frame: %d\n",
+				ret);
+			frame->msg.status = ret;
+			ssd1322fb_frame_complete(frame);
+			goto out_unlock;
+		}
+	}
+
+	// The next frame is encoded into the other buffer
+	par->next_frame ^= 1;
+	WRITE_ONCE(par->last_flush, jiffies);
+	par->stats.frames_flushed++;
+	goto out_unlock;
+
+out_put:
+	pm_runtime_mark_last_busy(&par->spi->dev);
+	pm_runtime_put_autosuspend(&par->spi->dev);
+out_unlock:
+	mutex_unlock(&par->lock);
+	return ret;
+}
+
+static void ssd1322fb_flush_work(struct kthread_work *work)
+{
+	struct ssd1322fb_par *par = container_of(work, struct ssd1322fb_par,
+						 flush_work.work);
+
+	ssd1322fb_update_display(par);
+}
+
+static const char *const ssd1322fb_sched_names[] = {
+	[SSD1322_SCHED_NORMAL] = "normal",
+	[SSD1322_SCHED_FIFO_LOW] = "fifo-low",
+	[SSD1322_SCHED_FIFO] = "fifo",
+};
+
+static int ssd1322fb_set_sched(struct ssd1322fb_par *par, int policy,
+			       int nice)
+{
+	struct task_struct *task = par->kworker->task;
+
+	if (policy < 0 || policy >= ARRAY_SIZE(ssd1322fb_sched_names))
+		return -EINVAL;
+	if (nice < MIN_NICE || nice > MAX_NICE)
+		return -EINVAL;
+
+	switch (policy) {
+	case SSD1322_SCHED_FIFO_LOW:
+		sched_set_fifo_low(task);
+		break;
+	case SSD1322_SCHED_FIFO:
+		sched_set_fifo(task);
+		break;
+	default:
+		sched_set_normal(task, nice);
+		break;
+	}
+	par->sched_policy = policy;
+	par->sched_nice = policy == SSD1322_SCHED_NORMAL ? nice : 0;
+
+	return 0;
+}
+
+static unsigned long ssd1322fb_flush_delay(struct ssd1322fb_par *par,
+					   unsigned long min_delay)
+{
+	unsigned int max_fps = READ_ONCE(par->max_fps);
+	unsigned long now = jiffies;
+	unsigned long next;
+
+	// Frames never start closer together than the refresh rate allows
+	if (max_fps) {
+		next = READ_ONCE(par->last_flush) + DIV_ROUND_UP(HZ, max_fps);
+		if (time_before(now + min_delay, next))
+			return next - now;
+	}
+
+	return min_delay;
+}
+
+static void ssd1322fb_flush_now(struct ssd1322fb_par *par)
+{
+	// Explicit flushes skip the coalescing window, not the rate cap
+	if (!READ_ONCE(par->stopping))
+		kthread_mod_delayed_work(par->kworker, &par->flush_work,
+					 ssd1322fb_flush_delay(par, 0));
+}
+
+static int ssd1322fb_wait_flush(struct ssd1322fb_par *par, unsigned long seq)
+{
+	unsigned long flags;
+	bool failed;
+	long ret;
+
+	ret = wait_event_interruptible_timeout(
+		par->frame_wq,
+		!ssd1322fb_seq_before(READ_ONCE(par->done_seq), seq),
+		msecs_to_jiffies(SSD1322_FLUSH_TIMEOUT_MS));
+	if (ret < 0)
+		return ret;
+	if (!ret)
+		return -ETIMEDOUT;
+
+	// Flushes skipped as identical complete a sequence without a frame,
+	// so the result is looked up by sequence number, not taken from the
+	// last frame
+	spin_lock_irqsave(&par->damage_lock, flags);
+	failed = ssd1322fb_seq_before(par->err_from, seq) &&
+		 !ssd1322fb_seq_before(par->err_seq, seq);
+	spin_unlock_irqrestore(&par->damage_lock, flags);
+
+	return failed ? -EIO : 0;
+}
+
+static void ssd1322fb_schedule_flush(struct ssd1322fb_par *par)
+{
+	unsigned long delay;
+
+	if (READ_ONCE(par->stopping))
+		return;
+
+	// The timer is not pushed back by later updates, so everything
+	// damaged within the coalescing window goes out in one frame
+	delay = ssd1322fb_flush_delay(
+		par, usecs_to_jiffies(READ_ONCE(par->coalesce_us)));
+	if (!kthread_queue_delayed_work(par->kworker, &par->flush_work, delay))
+		par->stats.updates_coalesced++;
+}
+
+static void ssd1322fb_deferred_io(struct fb_info *info,
+				  struct list_head *pagereflist)
+{
+	struct ssd1322fb_par *par = info->par;
+	struct fb_deferred_io_pageref *pageref;
+
+	// Every page dirtied during the flush delay goes out in one update
+	list_for_each_entry(pageref, pagereflist, list)
+		ssd1322fb_damage_range(par, pageref->offset, PAGE_SIZE);
+
+	ssd1322fb_schedule_flush(par);
+}
+
+static void ssd1322_pack9_words(u8 *out, const u16 *words, size_t count)
+{
+	u8 block[SSD1322_PACK9_BLOCK_BYTES];
+	__be64 head;
+	u64 bits = 0;
+	size_t i;
+
+	// Word i starts at bit 9 * i of the block, MSB first
+	for (i = 0; i < count && i < 7; i++)
+		bits |= (u64)(words[i] & 0x1FF) << (55 - 9 * i);
+
+	block[8] = 0;
+	if (count == SSD1322_PACK9_BLOCK_WORDS) {
+		bits |= words[7] >> 8;
+		block[8] = words[7] & 0xFF;
+	}
+
+	head = cpu_to_be64(bits);
+	memcpy(block, &head, sizeof(head));
+	memcpy(out, block, DIV_ROUND_UP(count * 9, 8));
+}
+
+static void ssd1322_pack9_data(u8 *out, const u8 *data)
+{
+	// D/C bits of all eight words, then each data byte below its D/C bit
+	u64 bits = 0x8040201008040201ULL | (u64)data[0] << 55 |
+		   (u64)data[1] << 46 | (u64)data[2] << 37 |
+		   (u64)data[3] << 28 | (u64)data[4] << 19 |
+		   (u64)data[5] << 10 | (u64)data[6] << 1;
+	__be64 head = cpu_to_be64(bits);
+
+	memcpy(out, &head, sizeof(head));
+	out[8] = data[7];
+}
+
+static size_t ssd1322_pack9(u8 *out, u8 cmd, const u8 *data, size_t data_len)
+{
+	u16 words[SSD1322_PACK9_BLOCK_WORDS];
+	size_t total_bytes;
+	size_t head, i;
+
+	total_bytes = DIV_ROUND_UP((data_len + 1) * 9, 8);
+
+	// The command word (D/C bit 0) shares the first block with up to
+	// seven data words
+	head = min_t(size_t, data_len, SSD1322_PACK9_BLOCK_WORDS - 1);
+	words[0] = cmd;
+	for (i = 0; i < head; i++)
+		words[i + 1] = 0x100 | data[i];
+	ssd1322_pack9_words(out, words, head + 1);
+	if (head == data_len)
+		return total_bytes;
+
+	out += SSD1322_PACK9_BLOCK_BYTES;
+	data += head;
+	data_len -= head;
+
+	// The rest is block aligned, 8 data bytes become 9 output bytes
+	for (; data_len >= SSD1322_PACK9_BLOCK_WORDS;
+	     data_len -= SSD1322_PACK9_BLOCK_WORDS) {
+		ssd1322_pack9_data(out, data);
+		out += SSD1322_PACK9_BLOCK_BYTES;
+		data += SSD1322_PACK9_BLOCK_WORDS;
+	}
+
+	if (data_len) {
+		for (i = 0; i < data_len; i++)
+			words[i] = 0x100 | data[i];
+		ssd1322_pack9_words(out, words, data_len);
+	}
+
+	return total_bytes;
+}
+
+/*
+ * Each framebuffer byte holds two pixels. On the wire each pixel is
+ * duplicated into a full GDDRAM byte and sent as a data word, so every
+ * framebuffer byte maps to the same fixed 18-bit pattern.
+ */
+#define SSD1322_DUP9(b)                                                  \
+	(((0x100 | (((b) >> 4) * 0x11)) << 9) | (0x100 | (((b) & 0x0F) * 0x11)))
+#define SSD1322_DUP9_4(b)                                                \
+	SSD1322_DUP9(b), SSD1322_DUP9((b) + 1), SSD1322_DUP9((b) + 2), \
+		SSD1322_DUP9((b) + 3)
+#define SSD1322_DUP9_16(b)                                               \
+	SSD1322_DUP9_4(b), SSD1322_DUP9_4((b) + 4),                      \
+		SSD1322_DUP9_4((b) + 8), SSD1322_DUP9_4((b) + 12)
+#define SSD1322_DUP9_64(b)                                               \
+	SSD1322_DUP9_16(b), SSD1322_DUP9_16((b) + 16),                   \
+		SSD1322_DUP9_16((b) + 32), SSD1322_DUP9_16((b) + 48)
+
+static const u32 ssd1322_dup9_lut[256] = {
+	SSD1322_DUP9_64(0), SSD1322_DUP9_64(64), SSD1322_DUP9_64(128),
+	SSD1322_DUP9_64(192),
+};
+
+// Packs the 18-bit patterns of 4 framebuffer bytes into 9 output bytes
+static void ssd1322_enc_group(u8 *out, u32 c0, u32 c1, u32 c2, u32 c3)
+{
+	__be64 head = cpu_to_be64((u64)c0 << 46 | (u64)c1 << 28 |
+				  (u64)c2 << 10 | c3 >> 8);
+
+	memcpy(out, &head, sizeof(head));
+	out[8] = c3 & 0xFF;
+}
+
+static void ssd1322_enc_init(struct ssd1322_enc *enc, u8 *out, bool native,
+			     bool dup)
+{
+	enc->start = out;
+	enc->out = out;
+	enc->npending = 0;
+	enc->native = native;
+	enc->dup = dup;
+}
+
+static void ssd1322_enc_span_native(struct ssd1322_enc *enc, const u8 *src,
+				    size_t len)
+{
+	u16 *out = (u16 *)enc->out;
+	u32 code;
+
+	// The controller shifts out 9-bit words, one table entry holds two
+	if (!enc->dup) {
+		while (len--)
+			*out++ = 0x100 | *src++;
+	} else {
+		while (len--) {
+			code = ssd1322_dup9_lut[*src++];
+			*out++ = code >> 9;
+			*out++ = code & 0x1FF;
+		}
+	}
+
+	enc->out = (u8 *)out;
+}
+
+// Without duplication every byte is one data word, 8 of them fill a block
+static void ssd1322_enc_span_nodup(struct ssd1322_enc *enc, const u8 *src,
+				   size_t len)
+{
+	u8 *out = enc->out;
+
+	while (enc->npending && len) {
+		enc->pending[enc->npending++] = *src++;
+		len--;
+		if (enc->npending == SSD1322_ENC_GROUP_NATIVE) {
+			ssd1322_pack9_data(out, enc->pending);
+			out += SSD1322_PACK9_BLOCK_BYTES;
+			enc->npending = 0;
+		}
+	}
+
+	for (; len >= SSD1322_ENC_GROUP_NATIVE;
+	     len -= SSD1322_ENC_GROUP_NATIVE) {
+		ssd1322_pack9_data(out, src);
+		out += SSD1322_PACK9_BLOCK_BYTES;
+		src += SSD1322_ENC_GROUP_NATIVE;
+	}
+
+	while (len--)
+		enc->pending[enc->npending++] = *src++;
+
+	enc->out = out;
+}
+
+static void ssd1322_enc_span(struct ssd1322_enc *enc, const u8 *src,
+			     size_t len)
+{
+	const u32 *lut = ssd1322_dup9_lut;
+	u8 *out = enc->out;
+
+	if (enc->native) {
+		ssd1322_enc_span_native(enc, src, len);
+		return;
+	}
+	if (!enc->dup) {
+		ssd1322_enc_span_nodup(enc, src, len);
+		return;
+	}
+
+	// Complete a group left over from the previous span
+	while (enc->npending && len) {
+		enc->pending[enc->npending++] = *src++;
+		len--;
+		if (enc->npending == SSD1322_ENC_GROUP) {
+			ssd1322_enc_group(out, lut[enc->pending[0]],
+					  lut[enc->pending[1]],
+					  lut[enc->pending[2]],
+					  lut[enc->pending[3]]);
+			out += SSD1322_PACK9_BLOCK_BYTES;
+			enc->npending = 0;
+		}
+	}
+
+	for (; len >= SSD1322_ENC_GROUP; len -= SSD1322_ENC_GROUP) {
+		ssd1322_enc_group(out, lut[src[0]], lut[src[1]], lut[src[2]],
+				  lut[src[3]]);
+		out += SSD1322_PACK9_BLOCK_BYTES;
+		src += SSD1322_ENC_GROUP;
+	}
+
+	while (len--)
+		enc->pending[enc->npending++] = *src++;
+
+	enc->out = out;
+}
+
+static size_t ssd1322_enc_finish(struct ssd1322_enc *enc)
+{
+	u32 codes[SSD1322_ENC_GROUP] = { 0 };
+	u16 words[SSD1322_ENC_GROUP_NATIVE];
+	u8 block[SSD1322_PACK9_BLOCK_BYTES];
+	unsigned int i;
+
+	if (enc->npending && !enc->dup) {
+		for (i = 0; i < enc->npending; i++)
+			words[i] = 0x100 | enc->pending[i];
+		ssd1322_pack9_words(enc->out, words, enc->npending);
+		enc->out += DIV_ROUND_UP(enc->npending * 9, 8);
+		enc->npending = 0;
+	} else if (enc->npending) {
+		// Padding bits stay zero, they never form a complete word
+		for (i = 0; i < enc->npending; i++)
+			codes[i] = ssd1322_dup9_lut[enc->pending[i]];
+		ssd1322_enc_group(block, codes[0], codes[1], codes[2],
+				  codes[3]);
+		memcpy(enc->out, block, DIV_ROUND_UP(enc->npending * 18, 8));
+		enc->out += DIV_ROUND_UP(enc->npending * 18, 8);
+		enc->npending = 0;
+	}
+
+	return enc->out - enc->start;
+}
+
+static size_t ssd1322_encode_cmd(struct ssd1322fb_par *par, u8 *out, u8 cmd,
+				 const u8 *data, size_t data_len)
+{
+	u16 *words = (u16 *)out;
+	size_t i;
+
+	if (!par->native_9bit)
+		return ssd1322_pack9(out, cmd, data, data_len);
+
+	words[0] = cmd;
+	for (i = 0; i < data_len; i++)
+		words[i + 1] = 0x100 | data[i];
+
+	return (data_len + 1) * sizeof(u16);
+}
+
+static size_t ssd1322_encode_words(struct ssd1322fb_par *par, u8 *out,
+				   const u16 *words, size_t count)
+{
+	size_t i;
+
+	if (par->native_9bit) {
+		memcpy(out, words, count * sizeof(u16));
+		return count * sizeof(u16);
+	}
+
+	// Each block of eight words fills exactly nine bytes, so the blocks
+	// line up into one continuous stream
+	for (i = 0; i < count; i += SSD1322_PACK9_BLOCK_WORDS)
+		ssd1322_pack9_words(out + i / SSD1322_PACK9_BLOCK_WORDS *
+						  SSD1322_PACK9_BLOCK_BYTES,
+				    words + i,
+				    min_t(size_t, count - i,
+					  SSD1322_PACK9_BLOCK_WORDS));
+
+	return DIV_ROUND_UP(count * 9, 8);
+}
+
+static int ssd1322_cmd(struct ssd1322fb_par *par, u8 cmd, const u8 *data,
+		       size_t data_len)
+{
+	struct spi_device *spi = par->spi;
+	size_t total_bytes;
+	u8 *tx_buf;
+	int ret;
+	struct spi_transfer xfer;
+	struct spi_message msg;
+
+	if (par->native_9bit)
+		total_bytes = (data_len + 1) * sizeof(u16);
+	else
+		total_bytes = DIV_ROUND_UP((data_len + 1) * 9, 8);
+
+	// Commands are short, pixel data goes through the frame buffers
+	if (total_bytes > SSD1322_CMD_BUF_LEN)
+		return -EINVAL;
+	tx_buf = par->cmd_buf;
+
+	mutex_lock(&par->cmd_lock);
+	// Fill tx_buf with cmd (D/C bit 0) and data (D/C bit 1)
+	ssd1322_encode_cmd(par, tx_buf, cmd, data, data_len);
+
+	// SPI transfer setup
+	spi_message_init(&msg);
+	memset(&xfer, 0, sizeof(xfer)); // Initialize the spi_transfer structure
+	xfer.tx_buf = tx_buf;
+	xfer.len = total_bytes;
+	xfer.bits_per_word = par->bits_per_word;
+	xfer.speed_hz = READ_ONCE(par->cmd_speed_hz);
+	xfer.cs_change = 0; // Ensure CS is deasserted after transfer
+	spi_message_add_tail(&xfer, &msg);
+
+	trace_ssd1322fb_cmds(par, cmd, data_len + 1, total_bytes);
+	ret = spi_sync(spi, &msg);
+	mutex_unlock(&par->cmd_lock);
+	if (ret)
+		dev_err(&spi->dev, "Failed to write to SSD1322: %d\n", ret);
+
+	return ret;
+}
+
+static void ssd1322_fit_gray_table(const u8 *levels, u8 *gs, bool *inverse)
+{
+	int i;
+
+	*inverse = levels[SSD1322_GRAYSCALE - 1] < levels[0];
+
+	// GS0 is fixed at 0, every later level at least one clock above the
+	// previous one and leaving room for the levels after it
+	gs[0] = 0;
+	for (i = 1; i < SSD1322_GRAYSCALE; i++)
+		gs[i] = clamp_t(int,
+				levels[*inverse ? SSD1322_GRAYSCALE - 1 - i : i],
+				gs[i - 1] + 1,
+				SSD1322_GRAY_MAX - (SSD1322_GRAYSCALE - 1 - i));
+}
+
+static int ssd1322_load_gray_table(struct ssd1322fb_par *par)
+{
+	u16 words[SSD1322_GRAYSCALE + 2];
+	struct spi_transfer xfer = {
+		.tx_buf = par->cmd_buf,
+		.bits_per_word = par->bits_per_word,
+		.speed_hz = READ_ONCE(par->cmd_speed_hz),
+	};
+	size_t count = 0;
+	int ret;
+	int i;
+
+	lockdep_assert_held(&par->cmd_lock);
+
+	if (par->gray_custom) {
+		words[count++] = SSD1322_CMD_SET_GRAYSCALE_TABLE;
+		for (i = 1; i < SSD1322_GRAYSCALE; i++)
+			words[count++] = 0x100 | par->gray_gs[i];
+		words[count++] = SSD1322_CMD_ENABLE_GRAYSCALE_TABLE;
+	} else {
+		words[count++] = SSD1322_CMD_DEFAULT_GRAYSCALE;
+	}
+	words[count++] = par->gray_inverse ? SSD1322_CMD_DISPLAY_INVERSE :
+					     SSD1322_CMD_DISPLAY_MODE;
+	xfer.len = ssd1322_encode_words(par, par->cmd_buf, words, count);
+	trace_ssd1322fb_cmds(par, words[0], count, xfer.len);
+
+	ret = spi_sync_transfer(par->spi, &xfer, 1);
+	if (ret)
+		dev_err(&par->spi->dev, "Failed to load gray table: %d\n", ret);
+
+	return ret;
+}
+
+static int ssd1322_set_gray_table(struct ssd1322fb_par *par, const u8 *levels)
+{
+	int ret;
+
+	mutex_lock(&par->cmd_lock);
+	if (levels) {
+		ssd1322_fit_gray_table(levels, par->gray_gs, &par->gray_inverse);
+		par->gray_custom = true;
+	} else {
+		par->gray_custom = false;
+		par->gray_inverse = false;
+	}
+	ret = ssd1322_load_gray_table(par);
+	mutex_unlock(&par->cmd_lock);
+
+	return ret;
+}
+
+// Function to set grayscale values
+static int ssd1322fb_setcolreg(unsigned regno, unsigned red, unsigned green,
+				unsigned blue, unsigned transp,
+				struct fb_info *info)
+{
+	struct ssd1322fb_par *par = info->par;
+	u32 *palette = info->pseudo_palette;
+
+	// Console colors for the RGB formats
+	if (info->fix.visual == FB_VISUAL_TRUECOLOR) {
+		if (regno >= SSD1322_PALETTE_LEN)
+			return -EINVAL;
+		palette[regno] =
+			(red >> (16 - info->var.red.length))
+				<< info->var.red.offset |
+			(green >> (16 - info->var.green.length))
+				<< info->var.green.offset |
+			(blue >> (16 - info->var.blue.length))
+				<< info->var.blue.offset;
+		return 0;
+	}
+
+	// Only the 4-bit format has one pixel value per panel gray level, the
+	// others keep a fixed ramp
+	if (par->bpp != 4)
+		return 0;
+	if (regno >= SSD1322_GRAYSCALE)
+		return -EINVAL;
+
+	par->cmap_levels[regno] =
+		DIV_ROUND_CLOSEST(((red * 77 + green * 151 + blue * 28) >> 8) *
+					  SSD1322_GRAY_MAX,
+				  0xFFFF);
+	return 0;
+}
+
+static int ssd1322fb_setcmap(struct fb_cmap *cmap, struct fb_info *info)
+{
+	struct ssd1322fb_par *par = info->par;
+	u32 i;
+	int ret;
+
+	for (i = 0; i < cmap->len; i++) {
+		ret = ssd1322fb_setcolreg(cmap->start + i, cmap->red[i],
+					  cmap->green[i], cmap->blue[i], 0,
+					  info);
+		if (ret)
+			return ret;
+	}
+
+	// The whole map goes to the panel as one table
+	if (info->fix.visual == FB_VISUAL_PSEUDOCOLOR)
+		return ssd1322_set_gray_table(par, par->cmap_levels);
+
+	return 0;
+}
+
+// Pixel formats accepted from user space, converted to 4 bits when flushed
+static const struct ssd1322fb_format ssd1322fb_formats[] = {
+	{ 1, FB_VISUAL_MONO10, 1, { 0, 1 }, { 0, 1 }, { 0, 1 } },
+	{ 4, FB_VISUAL_PSEUDOCOLOR, 1, { 0, 4 }, { 0, 4 }, { 0, 4 } },
+	{ 8, FB_VISUAL_STATIC_PSEUDOCOLOR, 1, { 0, 8 }, { 0, 8 }, { 0, 8 } },
+	{ 16, FB_VISUAL_TRUECOLOR, 0, { 11, 5 }, { 5, 6 }, { 0, 5 } },
+	{ 32, FB_VISUAL_TRUECOLOR, 0, { 16, 8 }, { 8, 8 }, { 0, 8 } },
+};
+
+static const struct ssd1322fb_format *ssd1322fb_find_format(u32 bpp)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(ssd1322fb_formats); i++)
+		if (ssd1322fb_formats[i].bpp == bpp)
+			return &ssd1322fb_formats[i];
+
+	return NULL;
+}
+
+static int ssd1322fb_check_var(struct fb_var_screeninfo *var,
+			       struct fb_info *info)
+{
+	struct ssd1322fb_par *par = info->par;
+	const struct ssd1322fb_format *fmt;
+	u32 max_rows;
+
+	fmt = ssd1322fb_find_format(var->bits_per_pixel);
+	if (!fmt)
+		return -EINVAL;
+
+	// The geometry is fixed, only the pixel format and the number of
+	// pages in use can change. The memory holds every page in any format.
+	max_rows = par->height * par->num_pages;
+	var->xres = info->var.xres;
+	var->yres = info->var.yres;
+	var->xres_virtual = info->var.xres;
+	var->yres_virtual = clamp(var->yres_virtual, var->yres, max_rows);
+	var->xoffset = 0;
+	if (var->yoffset >= var->yres_virtual ||
+	    (!(var->vmode & FB_VMODE_YWRAP) &&
+	     var->yoffset + var->yres > var->yres_virtual))
+		var->yoffset = 0;
+
+	var->grayscale = fmt->grayscale;
+	var->red = fmt->red;
+	var->green = fmt->green;
+	var->blue = fmt->blue;
+	memset(&var->transp, 0, sizeof(var->transp));
+	var->nonstd = 0;
+
+	return 0;
+}
+
+static int ssd1322fb_set_par(struct fb_info *info)
+{
+	struct ssd1322fb_par *par = info->par;
+	const struct ssd1322fb_format *fmt;
+	unsigned long flags;
+	u32 line_length;
+
+	fmt = ssd1322fb_find_format(info->var.bits_per_pixel);
+	if (!fmt)
+		return -EINVAL;
+	line_length = info->var.xres * fmt->bpp / 8;
+
+	mutex_lock(&par->lock);
+	info->fix.visual = fmt->visual;
+
+	// The old contents mean nothing in the new format
+	if (par->bpp != fmt->bpp) {
+		memset(par->buf, 0, par->buf_len);
+		WRITE_ONCE(info->fix.line_length, line_length);
+		WRITE_ONCE(par->bpp, fmt->bpp);
+	}
+
+	// Only the pages of the active format are exposed
+	WRITE_ONCE(info->fix.smem_len,
+		   line_length * par->height * par->num_pages);
+
+	// check_var may have moved the pan offset or shrunk the virtual
+	// screen. Start over from the new offset with an unscrolled panel
+	// and nothing known about its contents.
+	spin_lock_irqsave(&par->damage_lock, flags);
+	par->yoffset = info->var.yoffset;
+	par->scroll = 0;
+	spin_unlock_irqrestore(&par->damage_lock, flags);
+	par->start_line = 0;
+	par->start_line_dirty = true;
+	bitmap_fill(par->shadow_stale, par->height);
+	mutex_unlock(&par->lock);
+
+	ssd1322fb_damage(par, 0, 0, info->var.xres, info->var.yres);
+	ssd1322fb_flush_now(par);
+
+	return 0;
+}
+
+static int ssd1322fb_pan_display(struct fb_var_screeninfo *var,
+				 struct fb_info *info)
+{
+	struct ssd1322fb_par *par = info->par;
+	u32 yres_virtual = info->var.yres_virtual;
+	unsigned long flags;
+	int rows;
+
+	if (var->xoffset || var->yoffset >= yres_virtual)
+		return -EINVAL;
+	if (!(var->vmode & FB_VMODE_YWRAP) &&
+	    var->yoffset + info->var.yres > yres_virtual)
+		return -EINVAL;
+
+	// The next frame is read from the new offset. Panning by less than a
+	// screen moves the display start line, so only the rows panned in
+	// are sent. Otherwise only the rows that differ from the old page go
+	// out, thanks to the shadow diff.
+	spin_lock_irqsave(&par->damage_lock, flags);
+	rows = (var->yoffset + yres_virtual - par->yoffset) % yres_virtual;
+	if (rows > yres_virtual / 2)
+		rows -= yres_virtual;
+	if (rows && abs(rows) < info->var.yres)
+		ssd1322fb_scroll_locked(par, rows);
+	par->yoffset = var->yoffset;
+	spin_unlock_irqrestore(&par->damage_lock, flags);
+
+	ssd1322fb_damage(par, 0, 0, info->var.xres, info->var.yres);
+	ssd1322fb_flush_now(par);
+
+	return 0;
+}
+
+static int ssd1322fb_set_partial(struct ssd1322fb_par *par, u32 y,
+				 u32 height)
+{
+	struct fb_info *info = par->info;
+	unsigned long seq;
+	u8 band[2];
+	int ret;
+
+	if (height && (y >= info->var.yres || height > info->var.yres - y))
+		return -EINVAL;
+
+	if (!height) {
+		// Bring the dark rows up to date before they are shown again
+		mutex_lock(&par->lock);
+		par->partial_y = 0;
+		par->partial_height = 0;
+		mutex_unlock(&par->lock);
+
+		ssd1322fb_damage(par, 0, 0, info->var.xres, info->var.yres);
+		seq = READ_ONCE(par->damage_seq);
+		ssd1322fb_flush_now(par);
+		ret = ssd1322fb_wait_flush(par, seq);
+		if (ret)
+			return ret;
+
+		return ssd1322_cmd(par, SSD1322_CMD_EXIT_PARTIAL_DISPLAY, NULL,
+				   0);
+	}
+
+	band[0] = y;
+	band[1] = y + height - 1;
+	mutex_lock(&par->lock);
+	ret = ssd1322_cmd(par, SSD1322_CMD_ENTER_PARTIAL_DISPLAY, band,
+			  sizeof(band));
+	if (!ret) {
+		par->partial_y = y;
+		par->partial_height = height;
+	}
+	mutex_unlock(&par->lock);
+	if (ret)
+		return ret;
+
+	// Rows that only now entered the band may be behind
+	ssd1322fb_damage(par, 0, y, info->var.xres, height);
+	ssd1322fb_flush_now(par);
+
+	return 0;
+}
+
+static void ssd1322fb_fill_pattern(struct ssd1322fb_par *par, u8 *pattern,
+				   u32 n)
+{
+	u32 x, y;
+	u8 *row;
+
+	// Diagonal ramps moving by one step per frame, so every pixel changes
+	// in every frame and a corrupted word breaks a diagonal
+	for (y = 0; y < par->height; y++) {
+		row = pattern + y * par->pitch;
+		for (x = 0; x < par->width; x += 2)
+			row[x / 2] = ((x + y + n) & 0xF) << 4 |
+				     ((x + 1 + y + n) & 0xF);
+	}
+}
+
+static int ssd1322fb_burn_in(struct ssd1322fb_par *par, u32 frames)
+{
+	u64 errors = par->stats.transfer_errors;
+	unsigned long seq;
+	u8 *pattern;
+	int ret = 0;
+	u32 n;
+
+	if (!frames) {
+		// Back to the framebuffer contents
+		mutex_lock(&par->lock);
+		pattern = par->burn_in;
+		par->burn_in = NULL;
+		mutex_unlock(&par->lock);
+		if (!pattern)
+			return 0;
+		vfree(pattern);
+
+		ssd1322fb_damage(par, 0, 0, par->width, par->height);
+		ssd1322fb_flush_now(par);
+		return 0;
+	}
+
+	mutex_lock(&par->lock);
+	if (!par->burn_in)
+		par->burn_in = vzalloc(par->width * par->height / 2);
+	mutex_unlock(&par->lock);
+	if (!par->burn_in) {
+		par->stats.alloc_failures++;
+		return -ENOMEM;
+	}
+
+	par->burn_in_frames = 0;
+	for (n = 0; n < frames; n++) {
+		mutex_lock(&par->lock);
+		ssd1322fb_fill_pattern(par, par->burn_in, n);
+		mutex_unlock(&par->lock);
+
+		ssd1322fb_damage(par, 0, 0, par->width, par->height);
+		seq = READ_ONCE(par->damage_seq);
+		ssd1322fb_flush_now(par);
+		ret = ssd1322fb_wait_flush(par, seq);
+		if (ret == -EIO)
+			ret = 0; // Counted as an error, the run goes on
+		if (ret)
+			break;
+		par->burn_in_frames++;
+	}
+	par->burn_in_errors = par->stats.transfer_errors - errors;
+
+	return ret;
+}
+
+static enum hrtimer_restart ssd1322fb_anim_tick(struct hrtimer *timer)
+{
+	struct ssd1322fb_par *par = container_of(timer, struct ssd1322fb_par,
+						 anim_timer);
+	size_t frame_len = par->width * par->height / 2;
+	unsigned long flags;
+	bool done = false;
+
+	spin_lock_irqsave(&par->damage_lock, flags);
+	if (par->anim_index + 1 < par->anim_frames) {
+		par->anim_index++;
+	} else if (par->anim_loops && !--par->anim_loops) {
+		// The last frame stays, or the framebuffer comes back
+		done = true;
+		if (!par->anim_hold) {
+			par->anim_show = NULL;
+			goto out;
+		}
+	} else {
+		par->anim_index = 0;
+	}
+	par->anim_show = par->anim + par->anim_index * frame_len;
+out:
+	spin_unlock_irqrestore(&par->damage_lock, flags);
+
+	// Frames are diffed like any other update, and only the newest one
+	// goes out if the bus falls behind
+	ssd1322fb_damage(par, 0, 0, par->width, par->height);
+	ssd1322fb_flush_now(par);
+	if (done)
+		return HRTIMER_NORESTART;
+
+	hrtimer_forward_now(timer, par->anim_period);
+	return HRTIMER_RESTART;
+}
+
+static void ssd1322fb_anim_stop(struct ssd1322fb_par *par)
+{
+	unsigned long flags;
+
+	lockdep_assert_held(&par->anim_lock);
+
+	hrtimer_cancel(&par->anim_timer);
+	spin_lock_irqsave(&par->damage_lock, flags);
+	if (!par->anim_show) {
+		spin_unlock_irqrestore(&par->damage_lock, flags);
+		return;
+	}
+	par->anim_show = NULL;
+	spin_unlock_irqrestore(&par->damage_lock, flags);
+
+	ssd1322fb_damage(par, 0, 0, par->width, par->height);
+	ssd1322fb_flush_now(par);
+}
+
+static int ssd1322fb_anim_load(struct ssd1322fb_par *par,
+			       const void __user *data, u32 nframes)
+{
+	size_t frame_len = par->width * par->height / 2;
+	u8 *ring = NULL;
+	u8 *old;
+
+	lockdep_assert_held(&par->anim_lock);
+
+	if (nframes > SSD1322_ANIM_MAX_LEN / frame_len)
+		return -E2BIG;
+	if (nframes) {
+		ring = vmalloc(nframes * frame_len);
+		if (!ring) {
+			par->stats.alloc_failures++;
+			return -ENOMEM;
+		}
+		if (copy_from_user(ring, data, nframes * frame_len)) {
+			vfree(ring);
+			return -EFAULT;
+		}
+	}
+
+	// The update path may still scan the old ring until it is swapped
+	// under the update lock
+	ssd1322fb_anim_stop(par);
+	mutex_lock(&par->lock);
+	old = par->anim;
+	par->anim = ring;
+	par->anim_frames = nframes;
+	par->scan_anim = NULL;
+	mutex_unlock(&par->lock);
+	vfree(old);
+
+	return 0;
+}
+
+static int ssd1322fb_anim_play(struct ssd1322fb_par *par,
+			       const struct ssd1322fb_anim_play *play)
+{
+	unsigned long flags;
+
+	lockdep_assert_held(&par->anim_lock);
+
+	if (!par->anim)
+		return -ENODATA;
+	if (!play->fps || play->fps > SSD1322_ANIM_MAX_FPS ||
+	    play->flags & ~SSD1322FB_ANIM_FLAGS)
+		return -EINVAL;
+
+	hrtimer_cancel(&par->anim_timer);
+	spin_lock_irqsave(&par->damage_lock, flags);
+	par->anim_index = 0;
+	par->anim_loops = play->loops;
+	par->anim_hold = play->flags & SSD1322FB_ANIM_HOLD;
+	par->anim_show = par->anim;
+	spin_unlock_irqrestore(&par->damage_lock, flags);
+	par->anim_period = ns_to_ktime(div_u64(NSEC_PER_SEC, play->fps));
+
+	ssd1322fb_damage(par, 0, 0, par->width, par->height);
+	ssd1322fb_flush_now(par);
+	hrtimer_start(&par->anim_timer, par->anim_period, HRTIMER_MODE_REL);
+
+	return 0;
+}
+
+static int ssd1322fb_ioctl(struct fb_info *info, unsigned int cmd,
+			   unsigned long arg)
+{
+	struct ssd1322fb_par *par = info->par;
+	void __user *argp = (void __user *)arg;
+	struct ssd1322fb_anim_load load;
+	struct ssd1322fb_anim_play play;
+	struct ssd1322fb_partial partial;
+	struct ssd1322fb_flush flush;
+	unsigned long seq;
+	u32 crtc;
+	int ret;
+
+	switch (cmd) {
+	case SSD1322FB_IOCTL_FLUSH:
+		if (copy_from_user(&flush, argp, sizeof(flush)))
+			return -EFAULT;
+		if (flush.flags & ~SSD1322FB_FLUSH_FLAGS)
+			return -EINVAL;
+
+		if (!flush.width || !flush.height)
+			ssd1322fb_damage(par, 0, 0, info->var.xres,
+					 info->var.yres);
+		else
+			ssd1322fb_damage(par, flush.x, flush.y, flush.width,
+					 flush.height);
+
+		seq = READ_ONCE(par->damage_seq);
+		ssd1322fb_flush_now(par);
+		if (flush.flags & SSD1322FB_FLUSH_WAIT)
+			return ssd1322fb_wait_flush(par, seq);
+		return 0;
+
+	case FBIO_WAITFORVSYNC:
+		// There is no vertical sync on this bus, wait for everything
+		// damaged so far to reach the panel instead
+		if (get_user(crtc, (u32 __user *)argp))
+			return -EFAULT;
+		if (crtc)
+			return -ENODEV;
+
+		return ssd1322fb_wait_flush(par, READ_ONCE(par->damage_seq));
+
+	case SSD1322FB_IOCTL_SET_PARTIAL:
+		if (copy_from_user(&partial, argp, sizeof(partial)))
+			return -EFAULT;
+
+		return ssd1322fb_set_partial(par, partial.y, partial.height);
+
+	case SSD1322FB_IOCTL_ANIM_LOAD:
+		if (copy_from_user(&load, argp, sizeof(load)))
+			return -EFAULT;
+		if (load.reserved)
+			return -EINVAL;
+
+		mutex_lock(&par->anim_lock);
+		ret = ssd1322fb_anim_load(par, u64_to_user_ptr(load.data),
+					  load.nframes);
+		mutex_unlock(&par->anim_lock);
+		return ret;
+
+	case SSD1322FB_IOCTL_ANIM_PLAY:
+		if (copy_from_user(&play, argp, sizeof(play)))
+			return -EFAULT;
+
+		mutex_lock(&par->anim_lock);
+		ret = ssd1322fb_anim_play(par, &play);
+		mutex_unlock(&par->anim_lock);
+		return ret;
+
+	case SSD1322FB_IOCTL_ANIM_STOP:
+		mutex_lock(&par->anim_lock);
+		ssd1322fb_anim_stop(par);
+		mutex_unlock(&par->anim_lock);
+		return 0;
+
+	default:
+		return -ENOTTY;
+	}
+}
+
+// Pixels are packed two per byte, the left one in the upper nibble
+static inline u8 ssd1322fb_get_pixel(const u8 *row, u32 x)
+{
+	return (x & 1) ? row[x / 2] & 0x0F : row[x / 2] >> 4;
+}
+
+static inline void ssd1322fb_put_pixel(u8 *row, u32 x, u8 color)
+{
+	u8 *p = &row[x / 2];
+
+	if (x & 1)
+		*p = (*p & 0xF0) | color;
+	else
+		*p = (*p & 0x0F) | (color << 4);
+}
+
+static void ssd1322fb_fill_row(u8 *row, u32 x1, u32 x2, u8 color, bool xor)
+{
+	u8 *p;
+	u32 n;
+
+	// Odd edges only cover half a byte
+	if ((x1 & 1) && x1 < x2) {
+		if (xor)
+			row[x1 / 2] ^= color;
+		else
+			ssd1322fb_put_pixel(row, x1, color);
+		x1++;
+	}
+	if ((x2 & 1) && x1 < x2) {
+		x2--;
+		if (xor)
+			row[x2 / 2] ^= color << 4;
+		else
+			ssd1322fb_put_pixel(row, x2, color);
+	}
+
+	p = row + x1 / 2;
+	n = (x2 - x1) / 2;
+	if (!xor) {
+		memset(p, color * 0x11, n);
+		return;
+	}
+	while (n--)
+		*p++ ^= color * 0x11;
+}
+
+static void ssd1322fb_fillrect(struct fb_info *info,
+			       const struct fb_fillrect *rect)
+{
+	struct ssd1322fb_par *par = info->par;
+	u32 line_length = info->fix.line_length;
+	u32 x2, y2, y;
+	u8 color = rect->color & 0x0F;
+
+	if (rect->dx >= info->var.xres_virtual ||
+	    rect->dy >= info->var.yres_virtual)
+		return;
+	x2 = min(rect->dx + rect->width, info->var.xres_virtual);
+	y2 = min(rect->dy + rect->height, info->var.yres_virtual);
+
+	// Formats other than the panel's take the generic helper
+	if (par->bpp != 4) {
+		sys_fillrect(info, rect);
+		goto out;
+	}
+
+	for (y = rect->dy; y < y2; y++)
+		ssd1322fb_fill_row(par->buf + y * line_length, rect->dx, x2,
+				   color, rect->rop == ROP_XOR);
+
+out:
+	ssd1322fb_damage_area(par, rect->dx, rect->dy, x2 - rect->dx,
+			      y2 - rect->dy);
+	ssd1322fb_schedule_flush(par);
+}
+
+static void ssd1322fb_copy_row(u8 *dst, u32 dx, const u8 *src, u32 sx,
+			       u32 width)
+{
+	u32 i;
+
+	// Same nibble alignment between different rows: plain byte copy
+	if (dst != src && !((dx ^ sx) & 1)) {
+		if (dx & 1) {
+			ssd1322fb_put_pixel(dst, dx++,
+					    ssd1322fb_get_pixel(src, sx++));
+			width--;
+		}
+		memcpy(dst + dx / 2, src + sx / 2, width / 2);
+		if (width & 1)
+			ssd1322fb_put_pixel(
+				dst, dx + width - 1,
+				ssd1322fb_get_pixel(src, sx + width - 1));
+		return;
+	}
+
+	// Shifted by one nibble, or overlapping within the row: pixel by
+	// pixel, walking away from the overlap
+	if (dst == src && dx > sx) {
+		for (i = width; i--;)
+			ssd1322fb_put_pixel(dst, dx + i,
+					    ssd1322fb_get_pixel(src, sx + i));
+	} else {
+		for (i = 0; i < width; i++)
+			ssd1322fb_put_pixel(dst, dx + i,
+					    ssd1322fb_get_pixel(src, sx + i));
+	}
+}
+
+static int ssd1322fb_copy_scroll(struct ssd1322fb_par *par,
+				 const struct fb_copyarea *area, u32 width,
+				 u32 height)
+{
+	struct fb_info *info = par->info;
+	u32 yres_virtual = info->var.yres_virtual;
+	u32 yoffset = READ_ONCE(par->yoffset);
+	u32 sy, dy;
+
+	if (area->sx || area->dx || width != info->var.xres ||
+	    height >= info->var.yres)
+		return 0;
+
+	// Source and destination rows counted from the top of the screen
+	sy = (area->sy + yres_virtual - yoffset) % yres_virtual;
+	dy = (area->dy + yres_virtual - yoffset) % yres_virtual;
+	if (!dy && sy == info->var.yres - height)
+		return sy;
+	if (!sy && dy == info->var.yres - height)
+		return -dy;
+
+	return 0;
+}
+
+static void ssd1322fb_copyarea(struct fb_info *info,
+			       const struct fb_copyarea *area)
+{
+	struct ssd1322fb_par *par = info->par;
+	u32 line_length = info->fix.line_length;
+	struct fb_copyarea clipped;
+	u32 width = area->width;
+	u32 height = area->height;
+	unsigned long flags;
+	u32 i, y;
+	int rows;
+
+	if (max(area->dx, area->sx) >= info->var.xres_virtual ||
+	    max(area->dy, area->sy) >= info->var.yres_virtual)
+		return;
+	width = min(width, info->var.xres_virtual - max(area->dx, area->sx));
+	height = min(height, info->var.yres_virtual - max(area->dy, area->sy));
+	if (!width || !height)
+		return;
+
+	if (par->bpp != 4) {
+		// Formats other than the panel's take the generic helper
+		clipped = *area;
+		clipped.width = width;
+		clipped.height = height;
+		sys_copyarea(info, &clipped);
+	} else {
+		// Walk the rows away from the overlap
+		for (i = 0; i < height; i++) {
+			y = area->dy > area->sy ? height - 1 - i : i;
+			ssd1322fb_copy_row(
+				par->buf + (area->dy + y) * line_length,
+				area->dx,
+				par->buf + (area->sy + y) * line_length,
+				area->sx, width);
+		}
+	}
+
+	// Scrolling the whole screen moves the display start line instead.
+	// The full screen is diffed, but only the rows scrolled in differ.
+	rows = ssd1322fb_copy_scroll(par, area, width, height);
+	if (rows) {
+		spin_lock_irqsave(&par->damage_lock, flags);
+		ssd1322fb_scroll_locked(par, rows);
+		spin_unlock_irqrestore(&par->damage_lock, flags);
+		ssd1322fb_damage(par, 0, 0, info->var.xres, info->var.yres);
+	} else {
+		ssd1322fb_damage_area(par, area->dx, area->dy, width, height);
+	}
+	ssd1322fb_schedule_flush(par);
+}
+
+static void ssd1322fb_build_blit_lut(struct ssd1322fb_par *par, u8 fg, u8 bg)
+{
+	unsigned int g, k;
+	u8 hi, lo;
+
+	// Each glyph byte expands to 8 pixels, i.e. 4 framebuffer bytes
+	for (g = 0; g < 256; g++) {
+		for (k = 0; k < 4; k++) {
+			hi = (g & (0x80 >> (2 * k))) ? fg : bg;
+			lo = (g & (0x40 >> (2 * k))) ? fg : bg;
+			par->blit_lut[g][k] = (hi << 4) | lo;
+		}
+	}
+
+	par->blit_fg = fg;
+	par->blit_bg = bg;
+	par->blit_lut_valid = true;
+}
+
+static void ssd1322fb_blit_mono(struct ssd1322fb_par *par,
+				const struct fb_image *image)
+{
+	u32 line_length = par->info->fix.line_length;
+	u32 pitch = DIV_ROUND_UP(image->width, 8);
+	u8 fg = image->fg_color & 0x0F;
+	u8 bg = image->bg_color & 0x0F;
+	u32 full = image->width / 8;
+	u32 rem = image->width % 8;
+	const u8 *src;
+	const u8 *bits;
+	u8 *row, *out;
+	u32 x, y, i;
+
+	// The console draws with a handful of color pairs, so the table
+	// rarely needs rebuilding
+	if (!par->blit_lut_valid || par->blit_fg != fg || par->blit_bg != bg)
+		ssd1322fb_build_blit_lut(par, fg, bg);
+
+	for (y = 0; y < image->height; y++) {
+		src = (const u8 *)image->data + y * pitch;
+		row = par->buf + (image->dy + y) * line_length;
+
+		if (image->dx & 1) {
+			for (x = 0; x < image->width; x++)
+				ssd1322fb_put_pixel(
+					row, image->dx + x,
+					(src[x / 8] & (0x80 >> (x % 8))) ? fg :
+									   bg);
+			continue;
+		}
+
+		out = row + image->dx / 2;
+		for (i = 0; i < full; i++) {
+			memcpy(out, par->blit_lut[src[i]], 4);
+			out += 4;
+		}
+		if (rem) {
+			bits = par->blit_lut[src[full]];
+			memcpy(out, bits, rem / 2);
+			if (rem & 1)
+				out[rem / 2] = (out[rem / 2] & 0x0F) |
+					       (bits[rem / 2] & 0xF0);
+		}
+	}
+}
+
+static void ssd1322fb_imageblit(struct fb_info *info,
+				const struct fb_image *image)
+{
+	struct ssd1322fb_par *par = info->par;
+
+	if (image->dx + image->width > info->var.xres_virtual ||
+	    image->dy + image->height > info->var.yres_virtual)
+		return;
+
+	// Glyphs take the expansion table, logos and formats other than the
+	// panel's the generic helper
+	if (image->depth == 1 && par->bpp == 4)
+		ssd1322fb_blit_mono(par, image);
+	else
+		sys_imageblit(info, image);
+
+	ssd1322fb_damage_area(par, image->dx, image->dy, image->width,
+			      image->height);
+	ssd1322fb_schedule_flush(par);
+}
+
+// Framebuffer operations structure
+static struct fb_ops ssd1322fb_ops = {
+	.owner = THIS_MODULE,
+	.fb_check_var = ssd1322fb_check_var,
+	.fb_set_par = ssd1322fb_set_par,
+	.fb_setcolreg = ssd1322fb_setcolreg,
+	.fb_setcmap = ssd1322fb_setcmap,
+	.fb_fillrect = ssd1322fb_fillrect,
+	.fb_copyarea = ssd1322fb_copyarea,
+	.fb_imageblit = ssd1322fb_imageblit,
+	.fb_write = ssd1322fb_write,
+	.fb_read = ssd1322fb_read,
+	.fb_mmap = fb_deferred_io_mmap,
+	.fb_ioctl = ssd1322fb_ioctl,
+	.fb_pan_display = ssd1322fb_pan_display,
+};
+
+static ssize_t transfer_mode_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct ssd1322fb_par *par = info->par;
+
+	return sysfs_emit(buf, "%s\n", par->native_9bit ? "native" : "packed");
+}
+static DEVICE_ATTR_RO(transfer_mode);
+
+static ssize_t coalesce_us_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct ssd1322fb_par *par = info->par;
+
+	return sysfs_emit(buf, "%u\n", READ_ONCE(par->coalesce_us));
+}
+
+static ssize_t coalesce_us_store(struct device *dev,
+				 struct device_attribute *attr,
+				 const char *buf, size_t count)
+{
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct ssd1322fb_par *par = info->par;
+	unsigned int val;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &val);
+	if (ret)
+		return ret;
+	if (val > SSD1322_MAX_COALESCE_US)
+		return -EINVAL;
+
+	WRITE_ONCE(par->coalesce_us, val);
+	return count;
+}
+static DEVICE_ATTR_RW(coalesce_us);
+
+static ssize_t max_fps_show(struct device *dev, struct device_attribute *attr,
+			    char *buf)
+{
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct ssd1322fb_par *par = info->par;
+
+	return sysfs_emit(buf, "%u\n", READ_ONCE(par->max_fps));
+}
+
+static ssize_t max_fps_store(struct device *dev, struct device_attribute *attr,
+			     const char *buf, size_t count)
+{
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct ssd1322fb_par *par = info->par;
+	unsigned int val;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &val);
+	if (ret)
+		return ret;
+	if (val > HZ)
+		return -EINVAL;
+
+	WRITE_ONCE(par->max_fps, val);
+	return count;
+}
+static DEVICE_ATTR_RW(max_fps);
+
+static ssize_t gray_table_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct ssd1322fb_par *par = info->par;
+	ssize_t len = 0;
+	int i;
+
+	mutex_lock(&par->cmd_lock);
+	if (!par->gray_custom) {
+		len = sysfs_emit(buf, "default\n");
+	} else {
+		// Levels per pixel value, as written
+		for (i = 0; i < SSD1322_GRAYSCALE; i++)
+			len += sysfs_emit_at(buf, len, "%u%c",
+					     par->gray_gs[par->gray_inverse ?
+							  SSD1322_GRAYSCALE - 1 - i :
+							  i],
+					     i < SSD1322_GRAYSCALE - 1 ? ' ' :
+									 '\n');
+	}
+	mutex_unlock(&par->cmd_lock);
+
+	return len;
+}
+
+static ssize_t gray_table_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct ssd1322fb_par *par = info->par;
+	u8 levels[SSD1322_GRAYSCALE];
+	char *copy, *cur, *tok;
+	int n = 0;
+	int ret;
+
+	if (sysfs_streq(buf, "default")) {
+		ret = ssd1322_set_gray_table(par, NULL);
+		return ret ? ret : count;
+	}
+
+	copy = kstrdup(buf, GFP_KERNEL);
+	if (!copy)
+		return -ENOMEM;
+
+	// One pulse width per pixel value, 0 to SSD1322_GRAY_MAX
+	cur = copy;
+	ret = 0;
+	while ((tok = strsep(&cur, " \t\n"))) {
+		if (!*tok)
+			continue;
+		if (n == SSD1322_GRAYSCALE) {
+			ret = -EINVAL;
+			break;
+		}
+		ret = kstrtou8(tok, 0, &levels[n]);
+		if (ret)
+			break;
+		if (levels[n++] > SSD1322_GRAY_MAX) {
+			ret = -EINVAL;
+			break;
+		}
+	}
+	kfree(copy);
+	if (!ret && n != SSD1322_GRAYSCALE)
+		ret = -EINVAL;
+	if (ret)
+		return ret;
+
+	ret = ssd1322_set_gray_table(par, levels);
+	return ret ? ret : count;
+}
+static DEVICE_ATTR_RW(gray_table);
+
+static ssize_t partial_rows_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct ssd1322fb_par *par = info->par;
+	u32 y, height;
+
+	mutex_lock(&par->lock);
+	y = par->partial_y;
+	height = par->partial_height;
+	mutex_unlock(&par->lock);
+
+	return sysfs_emit(buf, "%u %u\n", y, height);
+}
+
+static ssize_t partial_rows_store(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t count)
+{
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct ssd1322fb_par *par = info->par;
+	u32 y, height;
+	int ret;
+
+	// First row and number of rows, a height of 0 leaves partial mode
+	if (sscanf(buf, "%u %u", &y, &height) != 2)
+		return -EINVAL;
+
+	ret = ssd1322fb_set_partial(par, y, height);
+	return ret ? ret : count;
+}
+static DEVICE_ATTR_RW(partial_rows);
+
+static ssize_t ssd1322fb_show_speed(struct ssd1322fb_par *par, u32 speed_hz,
+				    char *buf)
+{
+	// 0 runs at spi-max-frequency
+	return sysfs_emit(buf, "%u\n", speed_hz ? speed_hz :
+						 par->spi->max_speed_hz);
+}
+
+static int ssd1322fb_parse_speed(struct ssd1322fb_par *par, const char *buf,
+				 u32 *speed_hz)
+{
+	struct spi_controller *ctlr = par->spi->controller;
+	int ret;
+
+	ret = kstrtou32(buf, 0, speed_hz);
+	if (ret)
+		return ret;
+	if (*speed_hz && ctlr->min_speed_hz && *speed_hz < ctlr->min_speed_hz)
+		return -EINVAL;
+	// The SPI core caps faster clocks at the controller maximum
+	return 0;
+}
+
+static ssize_t cmd_speed_hz_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct ssd1322fb_par *par = info->par;
+
+	return ssd1322fb_show_speed(par, READ_ONCE(par->cmd_speed_hz), buf);
+}
+
+static ssize_t cmd_speed_hz_store(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t count)
+{
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct ssd1322fb_par *par = info->par;
+	u32 val;
+	int ret;
+
+	ret = ssd1322fb_parse_speed(par, buf, &val);
+	if (ret)
+		return ret;
+
+	WRITE_ONCE(par->cmd_speed_hz, val);
+	return count;
+}
+static DEVICE_ATTR_RW(cmd_speed_hz);
+
+static ssize_t pixel_speed_hz_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct ssd1322fb_par *par = info->par;
+
+	return ssd1322fb_show_speed(par, READ_ONCE(par->pixel_speed_hz), buf);
+}
+
+static ssize_t pixel_speed_hz_store(struct device *dev,
+				    struct device_attribute *attr,
+				    const char *buf, size_t count)
+{
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct ssd1322fb_par *par = info->par;
+	u32 val;
+	int ret;
+
+	ret = ssd1322fb_parse_speed(par, buf, &val);
+	if (ret)
+		return ret;
+
+	WRITE_ONCE(par->pixel_speed_hz, val);
+	return count;
+}
+static DEVICE_ATTR_RW(pixel_speed_hz);
+
+static ssize_t burn_in_show(struct device *dev, struct device_attribute *attr,
+			    char *buf)
+{
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct ssd1322fb_par *par = info->par;
+
+	// Frames sent and bus errors of the last run
+	return sysfs_emit(buf, "%u %llu\n", par->burn_in_frames,
+			  par->burn_in_errors);
+}
+
+static ssize_t burn_in_store(struct device *dev, struct device_attribute *attr,
+			     const char *buf, size_t count)
+{
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct ssd1322fb_par *par = info->par;
+	u32 frames;
+	int ret;
+
+	// Number of test frames to send, 0 shows the framebuffer again
+	ret = kstrtou32(buf, 0, &frames);
+	if (ret)
+		return ret;
+
+	mutex_lock(&par->burn_in_lock);
+	ret = ssd1322fb_burn_in(par, frames);
+	mutex_unlock(&par->burn_in_lock);
+	return ret ? ret : count;
+}
+static DEVICE_ATTR_RW(burn_in);
+
+static ssize_t flush_sched_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct ssd1322fb_par *par = info->par;
+	int policy = READ_ONCE(par->sched_policy);
+
+	if (policy == SSD1322_SCHED_NORMAL)
+		return sysfs_emit(buf, "%s %d\n", ssd1322fb_sched_names[policy],
+				  READ_ONCE(par->sched_nice));
+	return sysfs_emit(buf, "%s\n", ssd1322fb_sched_names[policy]);
+}
+
+static ssize_t flush_sched_store(struct device *dev,
+				 struct device_attribute *attr,
+				 const char *buf, size_t count)
+{
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct ssd1322fb_par *par = info->par;
+	char name[16];
+	int nice = 0;
+	int policy;
+	int ret;
+
+	// A policy name, "normal" optionally followed by the nice value
+	if (sscanf(buf, "%15s %d", name, &nice) < 1)
+		return -EINVAL;
+	policy = match_string(ssd1322fb_sched_names,
+			      ARRAY_SIZE(ssd1322fb_sched_names), name);
+
+	mutex_lock(&par->lock);
+	ret = ssd1322fb_set_sched(par, policy, nice);
+	mutex_unlock(&par->lock);
+	return ret ? ret : count;
+}
+static DEVICE_ATTR_RW(flush_sched);
+
+static ssize_t bus_lock_show(struct device *dev, struct device_attribute *attr,
+			     char *buf)
+{
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct ssd1322fb_par *par = info->par;
+
+	return sysfs_emit(buf, "%d\n", READ_ONCE(par->bus_lock));
+}
+
+static ssize_t bus_lock_store(struct device *dev, struct device_attribute *attr,
+			      const char *buf, size_t count)
+{
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct ssd1322fb_par *par = info->par;
+	bool val;
+	int ret;
+
+	ret = kstrtobool(buf, &val);
+	if (ret)
+		return ret;
+
+	WRITE_ONCE(par->bus_lock, val);
+	return count;
+}
+static DEVICE_ATTR_RW(bus_lock);
+
+static void ssd1322fb_print_hist(struct seq_file *m, const char *name,
+				 const u32 *hist)
+{
+	int i;
+
+	seq_printf(m, "%s:\n", name);
+	for (i = 0; i < SSD1322_HIST_BUCKETS; i++) {
+		if (!hist[i])
+			continue;
+		if (i == SSD1322_HIST_BUCKETS - 1)
+			seq_printf(m, "  >= %8lu us: %u\n", 1UL << (i - 1),
+				   hist[i]);
+		else
+			seq_printf(m, "  <  %8lu us: %u\n", 1UL << i, hist[i]);
+	}
+}
+
+static int ssd1322fb_latency_show(struct seq_file *m, void *v)
+{
+	struct ssd1322fb_par *par = m->private;
+
+	ssd1322fb_print_hist(m, "write to completion", par->stats.latency_hist);
+	ssd1322fb_print_hist(m, "diff and encode", par->stats.encode_hist);
+	ssd1322fb_print_hist(m, "transfer", par->stats.transfer_hist);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ssd1322fb_latency);
+
+static void ssd1322fb_debugfs_init(struct ssd1322fb_par *par)
+{
+	struct ssd1322fb_stats *stats = &par->stats;
+	char name[32];
+
+	snprintf(name, sizeof(name), "ssd1322fb-%s", dev_name(&par->spi->dev));
+	par->debugfs = debugfs_create_dir(name, NULL);
+
+	debugfs_create_u64("frames_flushed", 0444, par->debugfs,
+			   &stats->frames_flushed);
+	debugfs_create_u64("frames_skipped", 0444, par->debugfs,
+			   &stats->frames_skipped);
+	debugfs_create_u64("frames_split", 0444, par->debugfs,
+			   &stats->frames_split);
+	debugfs_create_u64("updates_coalesced", 0444, par->debugfs,
+			   &stats->updates_coalesced);
+	debugfs_create_u64("transfer_errors", 0444, par->debugfs,
+			   &stats->transfer_errors);
+	debugfs_create_u64("bytes_on_wire", 0444, par->debugfs,
+			   &stats->bytes_on_wire);
+	debugfs_create_u64("encode_ns", 0444, par->debugfs,
+			   &stats->encode_ns);
+	debugfs_create_u64("transfer_ns", 0444, par->debugfs,
+			   &stats->transfer_ns);
+	debugfs_create_u64("alloc_failures", 0444, par->debugfs,
+			   &stats->alloc_failures);
+	debugfs_create_file("latency", 0444, par->debugfs, par,
+			    &ssd1322fb_latency_fops);
+}
+
+static struct attribute *ssd1322fb_attrs[] = {
+	&dev_attr_transfer_mode.attr,
+	&dev_attr_coalesce_us.attr,
+	&dev_attr_max_fps.attr,
+	&dev_attr_gray_table.attr,
+	&dev_attr_partial_rows.attr,
+	&dev_attr_cmd_speed_hz.attr,
+	&dev_attr_pixel_speed_hz.attr,
+	&dev_attr_burn_in.attr,
+	&dev_attr_flush_sched.attr,
+	&dev_attr_bus_lock.attr,
+	NULL,
+};
 
-	ret = ssd1322_cmd(par, SSD1322_CMD_DISPLAY_ON, NULL, 0);
-	if (ret)
-		return ret;
+static const struct attribute_group ssd1322fb_attr_group = {
+	.attrs = ssd1322fb_attrs,
+};
 
-	ret = ssd1322_cmd(par, SSD1322_CMD_COMMAND_LOCK, (u8[]){ 0x12 }, 1);
-	if (ret)
-		return ret;
+// Created by the driver core along with the device, before the uevent
+static const struct attribute_group *ssd1322fb_attr_groups[] = {
+	&ssd1322fb_attr_group,
+	NULL,
+};
 
-	ret = ssd1322_cmd(par, SSD1322_CMD_SET_CLOCK_DIV,
-			  (u8[]){ DISPLAY_CLOCK_FREQUENCY }, 1);
-	if (ret)
-		return ret;
+#ifdef SSD1322_DRM
+static const u32 ssd1322_drm_formats[] = {
+	DRM_FORMAT_XRGB8888,
+};
 
-	ret = ssd1322_cmd(par, SSD1322_CMD_SET_MULTIPLEX_RATIO,
-			  (u8[]){ MULTIPLEX_RATIO }, 1);
-	if (ret)
-		return ret;
+static void ssd1322_drm_blit(struct ssd1322fb_par *par, const void *vaddr,
+			     const struct drm_framebuffer *fb,
+			     const struct drm_rect *clip)
+{
+	u32 line_length = par->info->fix.line_length;
+	const u32 *src;
+	u32 x1, x2, y1, y2;
+	u32 x, y;
+	u8 *dst;
+
+	// Whole framebuffer bytes, two pixels each
+	x1 = round_down(max(clip->x1, 0), 2);
+	x2 = round_up(min_t(u32, clip->x2, par->info->var.xres), 2);
+	y1 = max(clip->y1, 0);
+	y2 = min_t(u32, clip->y2, par->info->var.yres);
+	if (x1 >= x2 || y1 >= y2)
+		return;
+
+	for (y = y1; y < y2; y++) {
+		src = vaddr + y * fb->pitches[0];
+		dst = par->buf + y * line_length;
+		for (x = x1; x < x2; x += 2)
+			dst[x / 2] = ssd1322_xrgb_gray4(src[x]) << 4 |
+				     ssd1322_xrgb_gray4(src[x + 1]);
+	}
 
-	ret = ssd1322_cmd(par, SSD1322_CMD_SET_DISPLAY_OFFSET,
-			  (u8[]){ DISPLAY_OFFSET }, 1);
-	if (ret)
-		return ret;
+	ssd1322fb_damage(par, x1, y1, x2 - x1, y2 - y1);
+}
 
-	ret = ssd1322_cmd(par, SSD1322_CMD_FUNCTION_SELECTION,
-			  (u8[]){ FUNCTION_SELECTION }, 1);
-	if (ret)
-		return ret;
+static void ssd1322_drm_enable(struct drm_simple_display_pipe *pipe,
+			       struct drm_crtc_state *crtc_state,
+			       struct drm_plane_state *plane_state)
+{
+	struct ssd1322_drm *sdrm = container_of(pipe, struct ssd1322_drm, pipe);
+	struct drm_shadow_plane_state *shadow =
+		to_drm_shadow_plane_state(plane_state);
+	struct drm_framebuffer *fb = plane_state->fb;
+	struct drm_rect clip = DRM_RECT_INIT(0, 0, fb->width, fb->height);
+	int idx;
+
+	if (!drm_dev_enter(&sdrm->drm, &idx))
+		return;
+
+	// The whole screen goes out when the pipe is switched on
+	if (!drm_gem_fb_begin_cpu_access(fb, DMA_FROM_DEVICE)) {
+		ssd1322_drm_blit(sdrm->par, shadow->data[0].vaddr, fb, &clip);
+		drm_gem_fb_end_cpu_access(fb, DMA_FROM_DEVICE);
+		ssd1322fb_flush_now(sdrm->par);
+	}
 
-	ret = ssd1322_cmd(par, SSD1322_CMD_SET_START_LINE, (u8[]){ START_LINE },
-			  1);
-	if (ret)
-		return ret;
+	drm_dev_exit(idx);
+}
 
-	ret = ssd1322_cmd(par, SSD1322_CMD_SET_REMAP, (u8[]){ REMAP_SETTINGS },
-			  2);
-	if (ret)
-		return ret;
+static void ssd1322_drm_update(struct drm_simple_display_pipe *pipe,
+			       struct drm_plane_state *old_state)
+{
+	struct ssd1322_drm *sdrm = container_of(pipe, struct ssd1322_drm, pipe);
+	struct drm_plane_state *state = pipe->plane.state;
+	struct drm_shadow_plane_state *shadow = to_drm_shadow_plane_state(state);
+	struct drm_framebuffer *fb = state->fb;
+	struct drm_atomic_helper_damage_iter iter;
+	struct drm_rect clip;
+	int idx;
+
+	if (!fb || !pipe->crtc.state->active)
+		return;
+	if (!drm_dev_enter(&sdrm->drm, &idx))
+		return;
+
+	// Only the damage clips are converted, the window planner then
+	// sends just the pixels that differ from the panel
+	if (!drm_gem_fb_begin_cpu_access(fb, DMA_FROM_DEVICE)) {
+		drm_atomic_helper_damage_iter_init(&iter, old_state, state);
+		drm_atomic_for_each_plane_damage(&iter, &clip)
+			ssd1322_drm_blit(sdrm->par, shadow->data[0].vaddr, fb,
+					 &clip);
+		drm_gem_fb_end_cpu_access(fb, DMA_FROM_DEVICE);
+		ssd1322fb_flush_now(sdrm->par);
+	}
 
-	ret = ssd1322_cmd(par, SSD1322_CMD_MASTER_CONTRAST,
-			  (u8[]){ MASTER_CONTRAST_LEVEL }, 1);
-	if (ret)
-		return ret;
+	drm_dev_exit(idx);
+}
 
-	ret = ssd1322_cmd(par, SSD1322_CMD_CONTRAST_CONTROL,
-			  (u8[]){ CONTRAST_CONTROL_LEVEL }, 1);
-	if (ret)
-		return ret;
+static const struct drm_simple_display_pipe_funcs ssd1322_drm_pipe_funcs = {
+	.enable = ssd1322_drm_enable,
+	.update = ssd1322_drm_update,
+	DRM_GEM_SIMPLE_DISPLAY_PIPE_SHADOW_PLANE_FUNCS,
+};
 
-	ret = ssd1322_cmd(par, SSD1322_CMD_PHASE_LENGTH, (u8[]){ PHASE_LENGTH },
-			  1);
-	if (ret)
-		return ret;
+static int ssd1322_drm_get_modes(struct drm_connector *connector)
+{
+	struct ssd1322_drm *sdrm = container_of(connector, struct ssd1322_drm,
+						connector);
+	struct ssd1322fb_par *par = sdrm->par;
+	struct drm_display_mode panel_mode = {
+		DRM_SIMPLE_MODE(par->width, par->height, par->width_mm,
+				par->height_mm),
+	};
+	struct drm_display_mode *mode;
+
+	mode = drm_mode_duplicate(connector->dev, &panel_mode);
+	if (!mode)
+		return 0;
+
+	mode->type |= DRM_MODE_TYPE_PREFERRED;
+	drm_mode_probed_add(connector, mode);
+	connector->display_info.width_mm = mode->width_mm;
+	connector->display_info.height_mm = mode->height_mm;
+
+	return 1;
+}
 
-	ret = ssd1322_cmd(par, SSD1322_CMD_PRECHARGE_VOLTAGE,
-			  (u8[]){ PRECHARGE_VOLTAGE_LEVEL }, 1);
-	if (ret)
-		return ret;
+static const struct drm_connector_helper_funcs ssd1322_drm_connector_hfuncs = {
+	.get_modes = ssd1322_drm_get_modes,
+};
 
-	ret = ssd1322_cmd(par, SSD1322_CMD_EXTERNAL_VSL, (u8[]){ EXTERNAL_VSL },
-			  2);
-	if (ret)
-		return ret;
+static const struct drm_connector_funcs ssd1322_drm_connector_funcs = {
+	.reset = drm_atomic_helper_connector_reset,
+	.fill_modes = drm_helper_probe_single_connector_modes,
+	.destroy = drm_connector_cleanup,
+	.atomic_duplicate_state = drm_atomic_helper_connector_duplicate_state,
+	.atomic_destroy_state = drm_atomic_helper_connector_destroy_state,
+};
 
-	ret = ssd1322_cmd(par, SSD1322_CMD_VCOMH_VOLTAGE,
-			  (u8[]){ VCOMH_VOLTAGE_LEVEL }, 1);
-	if (ret)
-		return ret;
+static const struct drm_mode_config_funcs ssd1322_drm_mode_config_funcs = {
+	.fb_create = drm_gem_fb_create_with_dirty,
+	.atomic_check = drm_atomic_helper_check,
+	.atomic_commit = drm_atomic_helper_commit,
+};
 
-	ret = ssd1322_cmd(par, SSD1322_CMD_DISPLAY_MODE, NULL, 0);
-	if (ret)
-		return ret;
+DEFINE_DRM_GEM_FOPS(ssd1322_drm_fops);
+
+static const struct drm_driver ssd1322_drm_driver = {
+	.driver_features = DRIVER_GEM | DRIVER_MODESET | DRIVER_ATOMIC,
+	.fops = &ssd1322_drm_fops,
+	DRM_GEM_SHMEM_DRIVER_OPS,
+	.name = "ssd1322",
+	.desc = "SSD1322 OLED",
+	.date = "20240814",
+	.major = 1,
+	.minor = 0,
+};
 
-	ret = ssd1322_cmd(par, SSD1322_CMD_EXIT_PARTIAL_DISPLAY, NULL, 0);
-	if (ret)
-		return ret;
+static int ssd1322_drm_register(struct ssd1322fb_par *par)
+{
+	struct device *dev = &par->spi->dev;
+	struct ssd1322_drm *sdrm;
+	struct drm_device *drm;
+	int ret;
 
-	ret = ssd1322_cmd(
-		par, SSD1322_CMD_DISPLAY_ENHANCEMENT,
-		(u8[]){ DISPLAY_ENHANCEMENT_A, DISPLAY_ENHANCEMENT_B }, 2);
-	if (ret)
-		return ret;
+	sdrm = devm_drm_dev_alloc(dev, &ssd1322_drm_driver, struct ssd1322_drm,
+				  drm);
+	if (IS_ERR(sdrm))
+		return PTR_ERR(sdrm);
+	sdrm->par = par;
+	drm = &sdrm->drm;
 
-	ret = ssd1322_cmd(par, SSD1322_CMD_SET_GPIO, (u8[]){ GPIO_SETTING }, 1);
+	ret = drmm_mode_config_init(drm);
 	if (ret)
 		return ret;
-
-	ret = ssd1322_cmd(par, SSD1322_CMD_DEFAULT_GRAYSCALE, NULL, 0);
+	drm->mode_config.min_width = par->width;
+	drm->mode_config.max_width = par->width;
+	drm->mode_config.min_height = par->height;
+	drm->mode_config.max_height = par->height;
+	drm->mode_config.preferred_depth = 24;
+	drm->mode_config.funcs = &ssd1322_drm_mode_config_funcs;
+
+	drm_connector_helper_add(&sdrm->connector,
+				 &ssd1322_drm_connector_hfuncs);
+	ret = drm_connector_init(drm, &sdrm->connector,
+				 &ssd1322_drm_connector_funcs,
+				 DRM_MODE_CONNECTOR_SPI);
 	if (ret)
 		return ret;
 
-	ret = ssd1322_cmd(par, SSD1322_CMD_SECOND_PRECHARGE,
-			  (u8[]){ SECOND_PRECHARGE_PERIOD }, 1);
+	ret = drm_simple_display_pipe_init(drm, &sdrm->pipe,
+					   &ssd1322_drm_pipe_funcs,
+					   ssd1322_drm_formats,
+					   ARRAY_SIZE(ssd1322_drm_formats),
+					   NULL, &sdrm->connector);
 	if (ret)
 		return ret;
 
-	ret = ssd1322_cmd(par, SSD1322_CMD_DISPLAY_ON, NULL, 0);
+	// Clients pass damage clips with their commits
+	drm_plane_enable_fb_damage_clips(&sdrm->pipe.plane);
+	drm_mode_config_reset(drm);
+
+	ret = drm_dev_register(drm, 0);
 	if (ret)
 		return ret;
+	par->drm = drm;
+
+	// Legacy fbdev users get an emulated framebuffer on top
+	drm_fbdev_generic_setup(drm, 32);
 
-	dev_info(&par->spi->dev, "ssd1322fb oled init done.\n");
 	return 0;
 }
 
-static ssize_t ssd1322fb_read(struct fb_info *info, char __user *buf,
-			       size_t count, loff_t *ppos)
+static void ssd1322_drm_unregister(struct ssd1322fb_par *par)
 {
-	char *src;
+	drm_dev_unplug(par->drm);
+	drm_atomic_helper_shutdown(par->drm);
+}
+#endif
 
-	// Check if the position is valid
-	if (*ppos >= info->fix.smem_len)
-		return 0; // No more data to read
+// Tile groups waiting for their panels or driving a tiled framebuffer
+static LIST_HEAD(ssd1322fb_tiles);
+static DEFINE_MUTEX(ssd1322fb_tiles_lock);
 
-	// Adjust count if it goes beyond the end of the buffer
-	if (*ppos + count > info->fix.smem_len)
-		count = info->fix.smem_len - *ppos;
+static void ssd1322fb_tile_damage(struct ssd1322fb_tile *tile, u32 x, u32 y,
+				  u32 w, u32 h)
+{
+	struct fb_info *info = tile->info;
+	u32 line_length = info->fix.line_length;
+	struct ssd1322fb_par *par;
+	u32 x1, y1, x2, y2;
+	u32 px, py, row;
+	unsigned int i;
+
+	if (x >= info->var.xres || y >= info->var.yres || !w || !h)
+		return;
+	// Whole bytes, panel edges fall on even columns
+	x2 = round_up(min(x + w, info->var.xres), 2);
+	y2 = min(y + h, info->var.yres);
+	x = round_down(x, 2);
+
+	for (i = 0; i < tile->cols * tile->rows; i++) {
+		par = tile->panels[i];
+		px = i % tile->cols * tile->panel_width;
+		py = i / tile->cols * tile->panel_height;
+		x1 = max(x, px);
+		y1 = max(y, py);
+		if (x1 >= min(x2, px + tile->panel_width) ||
+		    y1 >= min(y2, py + tile->panel_height))
+			continue;
+
+		// Every panel flushes its part on its own bus
+		for (row = y1; row < min(y2, py + tile->panel_height); row++)
+			memcpy(par->buf + (row - py) * par->info->fix.line_length +
+				       (x1 - px) / 2,
+			       tile->buf + row * line_length + x1 / 2,
+			       (min(x2, px + tile->panel_width) - x1) / 2);
+		ssd1322fb_damage(par, x1 - px, y1 - py,
+				 min(x2, px + tile->panel_width) - x1,
+				 min(y2, py + tile->panel_height) - y1);
+		ssd1322fb_schedule_flush(par);
+	}
+}
 
-	// Point to the framebuffer memory
-	src = (char *)info->screen_base + *ppos;
+static ssize_t ssd1322fb_tile_write(struct fb_info *info,
+				    const char __user *buf, size_t count,
+				    loff_t *ppos)
+{
+	struct ssd1322fb_tile *tile = info->par;
+	u32 line_length = info->fix.line_length;
+	u32 y;
 
-	// Copy framebuffer memory to user-space buffer
-	if (copy_to_user(buf, src, count))
+	if (*ppos >= info->fix.smem_len)
+		return -ENOSPC;
+	count = min_t(size_t, count, info->fix.smem_len - *ppos);
+
+	if (copy_from_user(tile->buf + *ppos, buf, count))
 		return -EFAULT;
 
-	// Update the position pointer
+	y = *ppos / line_length;
+	ssd1322fb_tile_damage(tile, 0, y, info->var.xres,
+			      DIV_ROUND_UP(*ppos + count, line_length) - y);
 	*ppos += count;
 
-	return count; // Return the number of bytes read
+	return count;
 }
 
-// Function that is called when data is written to the fb
-static ssize_t ssd1322fb_write(struct fb_info *info, const char __user *buf,
-				size_t count, loff_t *ppos)
+static void ssd1322fb_tile_fillrect(struct fb_info *info,
+				    const struct fb_fillrect *rect)
 {
-	struct ssd1322fb_par *par;
-	char *dst;
+	struct ssd1322fb_tile *tile = info->par;
+	u32 x2, y2, y;
 
-	// Initializing variables
-	par = info->par;
-	dst = (char *)info->screen_base + *ppos;
+	if (rect->dx >= info->var.xres || rect->dy >= info->var.yres)
+		return;
+	x2 = min(rect->dx + rect->width, info->var.xres);
+	y2 = min(rect->dy + rect->height, info->var.yres);
 
-	dev_dbg(&par->spi->dev, "SPI ssd1322fb_write called!\n");
-	dev_dbg(&par->spi->dev, "ppos is: %llu, count is: %zu\n", *ppos, count);
+	for (y = rect->dy; y < y2; y++)
+		ssd1322fb_fill_row(tile->buf + y * info->fix.line_length,
+				   rect->dx, x2, rect->color & 0x0F,
+				   rect->rop == ROP_XOR);
 
-	// Check for overflow and adjust count if necessary
-	if (*ppos >= info->fix.smem_len) {
-		dev_err(&par->spi->dev,
-			"Framebuffer write error: ppos (%llu) is beyond the framebuffer size (%u)\n",
-			*ppos, info->fix.smem_len);
-		return -ENOSPC; // No space left in the framebuffer
+	ssd1322fb_tile_damage(tile, rect->dx, rect->dy, x2 - rect->dx,
+			      y2 - rect->dy);
+}
+
+static void ssd1322fb_tile_copyarea(struct fb_info *info,
+				    const struct fb_copyarea *area)
+{
+	struct ssd1322fb_tile *tile = info->par;
+	u32 line_length = info->fix.line_length;
+	u32 width, height;
+	u32 i, y;
+
+	if (max(area->dx, area->sx) >= info->var.xres ||
+	    max(area->dy, area->sy) >= info->var.yres)
+		return;
+	width = min(area->width, info->var.xres - max(area->dx, area->sx));
+	height = min(area->height, info->var.yres - max(area->dy, area->sy));
+
+	// Walk the rows away from the overlap
+	for (i = 0; i < height; i++) {
+		y = area->dy > area->sy ? height - 1 - i : i;
+		ssd1322fb_copy_row(tile->buf + (area->dy + y) * line_length,
+				   area->dx,
+				   tile->buf + (area->sy + y) * line_length,
+				   area->sx, width);
 	}
 
-	if (*ppos + count > info->fix.smem_len) {
-		dev_info(
-			&par->spi->dev,
-			"Framebuffer write adjustment: ppos (%llu) + count (%zu) exceeds framebuffer size (%u)\n",
-			*ppos, count, info->fix.smem_len);
-		count = info->fix.smem_len - *ppos;
+	ssd1322fb_tile_damage(tile, area->dx, area->dy, width, height);
+}
+
+static void ssd1322fb_tile_imageblit(struct fb_info *info,
+				     const struct fb_image *image)
+{
+	struct ssd1322fb_tile *tile = info->par;
+	const u8 *data = (const u8 *)image->data;
+	u32 pitch = DIV_ROUND_UP(image->width, 8);
+	u8 *row;
+	u8 color;
+	u32 x, y;
+
+	if (image->dx + image->width > info->var.xres ||
+	    image->dy + image->height > info->var.yres)
+		return;
+
+	for (y = 0; y < image->height; y++) {
+		row = tile->buf + (image->dy + y) * info->fix.line_length;
+		for (x = 0; x < image->width; x++) {
+			if (image->depth == 1)
+				color = (data[y * pitch + x / 8] &
+					 (0x80 >> (x % 8))) ?
+						image->fg_color :
+						image->bg_color;
+			else
+				color = data[y * image->width + x];
+			ssd1322fb_put_pixel(row, image->dx + x, color & 0x0F);
+		}
 	}
 
-	// Copy data from user space to framebuffer memory
-	if (copy_from_user(dst, buf, count)) {
-		return -EFAULT;
+	ssd1322fb_tile_damage(tile, image->dx, image->dy, image->width,
+			      image->height);
+}
+
+static void ssd1322fb_tile_deferred_io(struct fb_info *info,
+				       struct list_head *pagereflist)
+{
+	struct ssd1322fb_tile *tile = info->par;
+	u32 line_length = info->fix.line_length;
+	struct fb_deferred_io_pageref *pageref;
+	u32 y;
+
+	list_for_each_entry(pageref, pagereflist, list) {
+		y = pageref->offset / line_length;
+		ssd1322fb_tile_damage(tile, 0, y, info->var.xres,
+				      DIV_ROUND_UP(pageref->offset + PAGE_SIZE,
+						   line_length) - y);
 	}
+}
 
-	// Update the position pointer
-	*ppos += count;
+static struct fb_ops ssd1322fb_tile_ops = {
+	.owner = THIS_MODULE,
+	.fb_fillrect = ssd1322fb_tile_fillrect,
+	.fb_copyarea = ssd1322fb_tile_copyarea,
+	.fb_imageblit = ssd1322fb_tile_imageblit,
+	.fb_write = ssd1322fb_tile_write,
+	.fb_read = ssd1322fb_read,
+	.fb_mmap = fb_deferred_io_mmap,
+};
 
-	// Trigger display update here
-	ssd1322fb_update_display(par);
+static int ssd1322fb_tile_register(struct ssd1322fb_tile *tile)
+{
+	struct ssd1322fb_par *first = tile->panels[0];
+	struct fb_info *info;
+	int ret;
 
-	return count; // Return the number of bytes written
+	info = framebuffer_alloc(0, &first->spi->dev);
+	if (!info)
+		return -ENOMEM;
+
+	info->par = tile;
+	info->fbops = &ssd1322fb_tile_ops;
+	strscpy(info->fix.id, "ssd1322fb-tile", sizeof(info->fix.id));
+	info->var.xres = tile->cols * tile->panel_width;
+	info->var.yres = tile->rows * tile->panel_height;
+	info->var.xres_virtual = info->var.xres;
+	info->var.yres_virtual = info->var.yres;
+	info->var.bits_per_pixel = 4;
+	info->var.grayscale = 1;
+	info->var.red.length = 4;
+	info->var.green.length = 4;
+	info->var.blue.length = 4;
+	info->fix.visual = FB_VISUAL_STATIC_PSEUDOCOLOR;
+	info->fix.line_length = info->var.xres / 2;
+	info->fix.smem_len = info->fix.line_length * info->var.yres;
+
+	ret = -ENOMEM;
+	tile->buf = vzalloc(PAGE_ALIGN(info->fix.smem_len));
+	if (!tile->buf)
+		goto err_release;
+	info->screen_base = tile->buf;
+
+	tile->defio.delay = first->defio.delay;
+	tile->defio.deferred_io = ssd1322fb_tile_deferred_io;
+	info->fbdefio = &tile->defio;
+	ret = fb_deferred_io_init(info);
+	if (ret)
+		goto err_free;
+
+	tile->info = info;
+	ret = register_framebuffer(info);
+	if (ret < 0)
+		goto err_defio;
+
+	dev_info(&first->spi->dev, "fb%d: %ux%u frame buffer over %u panels\n",
+		 info->node, info->var.xres, info->var.yres, tile->npanels);
+	return 0;
+
+err_defio:
+	tile->info = NULL;
+	fb_deferred_io_cleanup(info);
+err_free:
+	vfree(tile->buf);
+err_release:
+	framebuffer_release(info);
+	return ret;
 }
 
-static int ssd1322fb_update_display(struct ssd1322fb_par *par)
+static void ssd1322fb_tile_unregister(struct ssd1322fb_tile *tile)
+{
+	struct fb_info *info = tile->info;
+
+	if (!info)
+		return;
+
+	unregister_framebuffer(info);
+	fb_deferred_io_cleanup(info);
+	tile->info = NULL;
+	vfree(tile->buf);
+	framebuffer_release(info);
+}
+
+static int ssd1322fb_tile_add(struct ssd1322fb_par *par)
 {
-	u8 *image;
+	struct device *dev = &par->spi->dev;
+	struct ssd1322fb_tile *tile;
+	u32 grid[2], pos[2];
+	unsigned int slot;
+	u32 group;
 	int ret;
-	int i, j;
-	u8 col[2];
-	u8 row[2];
-	u8 *duplicated_image;
-	int duplicated_size;
-
-	// Initialize variables
-	image = par->info->screen_base;
-	col[0] = 0x1C; // Start column address
-	col[1] = 0x5B; // End column address
-	row[0] = 0x00; // Start row address
-	row[1] = 0x3F; // End row address
-
-	// Set column address
-	ret = ssd1322_cmd(par, SSD1322_CMD_SET_COLUMN_ADDR, col, 2);
-	if (ret) {
-		return ret;
+
+	if (device_property_read_u32(dev, "ssd,tile-group", &group) ||
+	    device_property_read_u32_array(dev, "ssd,tile-grid", grid, 2) ||
+	    device_property_read_u32_array(dev, "ssd,tile-position", pos, 2)) {
+		dev_err(dev, "Incomplete ssd,tile-* properties\n");
+		return -EINVAL;
+	}
+	if (!grid[0] || !grid[1] || grid[0] * grid[1] > SSD1322_MAX_TILES ||
+	    pos[0] >= grid[0] || pos[1] >= grid[1]) {
+		dev_err(dev, "Invalid tile grid %ux%u or position %u,%u\n",
+			grid[0], grid[1], pos[0], pos[1]);
+		return -EINVAL;
+	}
+	slot = pos[1] * grid[0] + pos[0];
+
+	mutex_lock(&ssd1322fb_tiles_lock);
+	list_for_each_entry(tile, &ssd1322fb_tiles, node)
+		if (tile->group == group)
+			goto found;
+
+	ret = -ENOMEM;
+	tile = kzalloc(sizeof(*tile), GFP_KERNEL);
+	if (!tile)
+		goto out_unlock;
+	tile->group = group;
+	tile->cols = grid[0];
+	tile->rows = grid[1];
+	tile->panel_width = par->width;
+	tile->panel_height = par->height;
+	list_add(&tile->node, &ssd1322fb_tiles);
+
+found:
+	ret = -EINVAL;
+	if (tile->cols != grid[0] || tile->rows != grid[1] ||
+	    tile->panel_width != par->width ||
+	    tile->panel_height != par->height) {
+		dev_err(dev,
+			"Tile grid or panel size differs from the rest of group %u\n",
+			group);
+		goto out_unlock;
+	}
+	ret = -EBUSY;
+	if (tile->panels[slot]) {
+		dev_err(dev, "Tile position %u,%u already taken\n", pos[0],
+			pos[1]);
+		goto out_unlock;
 	}
 
-	// Set row address
-	ret = ssd1322_cmd(par, SSD1322_CMD_SET_ROW_ADDR, row, 2);
-	if (ret) {
-		return ret;
+	tile->panels[slot] = par;
+	tile->npanels++;
+	par->tile = tile;
+	par->tile_slot = slot;
+
+	// The last panel of the group brings up the framebuffer
+	ret = 0;
+	if (tile->npanels == tile->cols * tile->rows) {
+		ret = ssd1322fb_tile_register(tile);
+		if (ret) {
+			tile->panels[slot] = NULL;
+			tile->npanels--;
+			par->tile = NULL;
+		}
 	}
 
-	// Calculate the size for the duplicated image data
-	// Image must have each nibble duplicated horizonatally
-	duplicated_size = SSD1322_WIDTH * SSD1322_HEIGHT;
-	duplicated_image = kmalloc(duplicated_size, GFP_KERNEL);
-	if (!duplicated_image) {
-		dev_err(&par->spi->dev,
-			"Failed to allocate memory for duplicated image\n");
-		return -ENOMEM;
+out_unlock:
+	if (tile && !tile->npanels) {
+		list_del(&tile->node);
+		kfree(tile);
+	}
+	mutex_unlock(&ssd1322fb_tiles_lock);
+	return ret;
+}
+
+static void ssd1322fb_tile_remove(struct ssd1322fb_par *par)
+{
+	struct ssd1322fb_tile *tile = par->tile;
+
+	mutex_lock(&ssd1322fb_tiles_lock);
+	ssd1322fb_tile_unregister(tile);
+	tile->panels[par->tile_slot] = NULL;
+	tile->npanels--;
+	par->tile = NULL;
+	if (!tile->npanels) {
+		list_del(&tile->node);
+		kfree(tile);
 	}
-	// Initialize the allocated memory to 0
-	memset(duplicated_image, 0, duplicated_size);
+	mutex_unlock(&ssd1322fb_tiles_lock);
+}
+
+static int ssd1322fb_register(struct ssd1322fb_par *par)
+{
+#ifndef SSD1322_DRM
+	struct fb_info *info = par->info;
+	int ret;
+#endif
 
-	// Duplicate and remap image data
+	// Panels of a tile group share one framebuffer
+	if (device_property_present(&par->spi->dev, "ssd,tile-group"))
+		return ssd1322fb_tile_add(par);
 
-	// For each row
-	for (i = 0; i < SSD1322_HEIGHT; i++) {
-		// For each column in the original image (128 columns, 64 bytes)
-		for (j = 0; j < SSD1322_WIDTH / 2; j++) {
-			// Get the original byte (2 pixels)
-			u8 byte = image[i * SSD1322_HEIGHT + j];
+#ifdef SSD1322_DRM
+	return ssd1322_drm_register(par);
+#else
+	ret = register_framebuffer(info);
+	if (ret < 0)
+		return ret;
 
-			// Isolate the upper and lower nibbles
-			u8 upper_nibble = (byte & 0xF0) >> 4; // Upper nibble
-			u8 lower_nibble = byte & 0x0F; // Lower nibble
+	dev_info(&par->spi->dev,
+		 "fb%d: %s frame buffer device, using %d KiB of video memory\n",
+		 info->node, info->fix.id, info->fix.smem_len >> 10);
+	return 0;
+#endif
+}
 
-			// Duplicate each nibble into its own byte
-			duplicated_image[i * SSD1322_WIDTH + j * 2] =
-				(upper_nibble << 4) | upper_nibble;
-			duplicated_image[i * SSD1322_WIDTH + j * 2 + 1] =
-				(lower_nibble << 4) | lower_nibble;
-		}
+static void ssd1322fb_unregister(struct ssd1322fb_par *par)
+{
+	if (par->tile) {
+		ssd1322fb_tile_remove(par);
+		return;
 	}
 
-	// Write the duplicated image data to RAM
-	ret = ssd1322_cmd(par, SSD1322_CMD_WRITE_RAM, duplicated_image,
-			  duplicated_size);
-	kfree(duplicated_image);
+#ifdef SSD1322_DRM
+	ssd1322_drm_unregister(par);
+#else
+	unregister_framebuffer(par->info);
+#endif
+}
 
-	if (ret) {
-		dev_err(&par->spi->dev,
-			"SPI transfer for duplicated_image failed: %d\n", ret);
+static int __maybe_unused ssd1322fb_runtime_suspend(struct device *dev)
+{
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct ssd1322fb_par *par = info->par;
+
+	// Sleep mode turns the panel off but keeps GDDRAM powered
+	return ssd1322_cmd(par, SSD1322_CMD_DISPLAY_OFF, NULL, 0);
+}
+
+static int __maybe_unused ssd1322fb_runtime_resume(struct device *dev)
+{
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct ssd1322fb_par *par = info->par;
+	unsigned long flags;
+	int ret;
+
+	// GDDRAM survived, the panel shows the last frame as soon as it is on
+	if (!par->gddram_lost)
+		return ssd1322_cmd(par, SSD1322_CMD_DISPLAY_ON, NULL, 0);
+
+	ret = ssd1322_init(par);
+	if (ret)
 		return ret;
-	}
+	par->gddram_lost = false;
 
-	dev_dbg(&par->spi->dev,
-		"SPI transfer for duplicated_image complete!\n");
+	// Nothing of the old contents is left, resend everything
+	spin_lock_irqsave(&par->damage_lock, flags);
+	par->resync = true;
+	spin_unlock_irqrestore(&par->damage_lock, flags);
+	ssd1322fb_damage(par, 0, 0, info->var.xres, info->var.yres);
 
 	return 0;
 }
 
-static int ssd1322_cmd(struct ssd1322fb_par *par, u8 cmd, const u8 *data,
-		       size_t data_len)
+static int __maybe_unused ssd1322fb_suspend(struct device *dev)
 {
-	struct spi_device *spi = par->spi;
-	size_t total_bits;
-	size_t total_bytes;
-	u8 *tx_buf;
-	int bit_offset;
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct ssd1322fb_par *par = info->par;
 	int ret;
-	size_t i;
-	struct spi_transfer xfer;
-	struct spi_message msg;
-
-	total_bits = (data_len + 1) * 9;
-	total_bytes = (total_bits + 7) / 8; // Round up to nearest byte
-	tx_buf = kmalloc(total_bytes, GFP_KERNEL);
-	if (!tx_buf)
-		return -ENOMEM;
-	memset(tx_buf, 0, total_bytes);
-
-	// Fill tx_buf with cmd and data
-
-	// Add cmd (command bit is 0)
-	bit_offset = 1;
-	// Insert the most significant bits of the command
-	tx_buf[0] |= (cmd >> bit_offset);
-	// Insert the remaining bits of the command
-	tx_buf[1] |= (cmd << (8 - bit_offset)) & 0xFF;
-
-	bit_offset += 8; // 1 bit command flag + 8 bits command
-
-	// Add data (data bit is 1)
-	for (i = 0; i < data_len; i++) {
-		int byte_index = bit_offset / 8;
-		int bit_index = bit_offset % 8;
-		// Set data/command bit to 1 for data
-		tx_buf[byte_index] |= (1 << (7 - bit_index));
-		if (bit_index < 7) {
-			tx_buf[byte_index] |= (data[i] >> (bit_index + 1));
-			if (byte_index + 1 < total_bytes) {
-				tx_buf[byte_index + 1] |=
-					(data[i] << (7 - bit_index)) & 0xFF;
-			}
-		} else {
-			if (byte_index + 1 < total_bytes) {
-				tx_buf[byte_index + 1] |= data[i];
-			}
-		}
-		bit_offset += 9;
-	}
 
-	// SPI transfer setup
-	spi_message_init(&msg);
-	memset(&xfer, 0, sizeof(xfer)); // Initialize the spi_transfer structure
-	xfer.tx_buf = tx_buf;
-	xfer.len = total_bytes;
-	xfer.cs_change = 0; // Ensure CS is deasserted after transfer
-	spi_message_add_tail(&xfer, &msg);
+	// Let the frames on the bus drain, damage keeps accumulating
+	ssd1322fb_stop(par);
 
-	ret = spi_sync(spi, &msg);
+	ret = pm_runtime_force_suspend(dev);
 	if (ret)
-		dev_err(&spi->dev, "Failed to write to SSD1322: %d\n", ret);
+		WRITE_ONCE(par->stopping, false);
 
-	kfree(tx_buf);
 	return ret;
 }
 
-// Function to set grayscale values
-static int ssd1322fb_setcolreg(unsigned regno, unsigned red, unsigned green,
-				unsigned blue, unsigned transp,
-				struct fb_info *info)
+static int __maybe_unused ssd1322fb_resume(struct device *dev)
 {
-	// Ensure grayscale is within range
-	if (red >= SSD1322_GRAYSCALE)
-		return -EINVAL;
+	struct fb_info *info = dev_get_drvdata(dev);
+	struct ssd1322fb_par *par = info->par;
+	unsigned long flags;
+	bool pending;
+	int ret;
 
-	// Implement grayscale setting here if needed
-	// For monochrome, just ensure value fits within the expected range
-	return 0;
+	// Unless the board keeps the panel powered, it comes back blank
+	if (!par->keep_power)
+		par->gddram_lost = true;
+
+	ret = pm_runtime_force_resume(dev);
+	WRITE_ONCE(par->stopping, false);
+
+	// Updates and scrolling made while suspended go out now. A panel that
+	// was asleep stays asleep until the next update.
+	spin_lock_irqsave(&par->damage_lock, flags);
+	pending = (par->damage.x1 < par->damage.x2 &&
+		   par->damage.y1 < par->damage.y2) || par->scroll;
+	spin_unlock_irqrestore(&par->damage_lock, flags);
+	if (pending)
+		ssd1322fb_schedule_flush(par);
+
+	return ret;
 }
 
-// Framebuffer operations structure
-static struct fb_ops ssd1322fb_ops = {
-	.owner = THIS_MODULE,
-	.fb_setcolreg = ssd1322fb_setcolreg,
-	.fb_fillrect = sys_fillrect,
-	.fb_copyarea = sys_copyarea,
-	.fb_imageblit = sys_imageblit,
-	.fb_write = ssd1322fb_write,
-	.fb_read = ssd1322fb_read,
+static const struct dev_pm_ops ssd1322fb_pm_ops = {
+	SET_SYSTEM_SLEEP_PM_OPS(ssd1322fb_suspend, ssd1322fb_resume)
+	SET_RUNTIME_PM_OPS(ssd1322fb_runtime_suspend, ssd1322fb_runtime_resume,
+			   NULL)
 };
 
 // Probe function for initializing the SSD1322 driver
 static int ssd1322fb_probe(struct spi_device *spi)
 {
+	struct ssd1322fb_rect full_row = {};
 	struct fb_info *info;
 	struct ssd1322fb_par *par;
+	const char *sched_name;
+	u32 idle_timeout_ms;
+	u32 flush_delay_ms;
+	u32 sched_nice;
+	u32 num_pages;
+	size_t page_len;
+	size_t words;
 	int retval;
+	int i;
 
 	retval = -ENOMEM;
 	info = framebuffer_alloc(sizeof(struct ssd1322fb_par), &spi->dev);
@@ -404,41 +3608,276 @@ static int ssd1322fb_probe(struct spi_device *spi)
 	par = info->par;
 	par->spi = spi;
 	par->info = info;
+	mutex_init(&par->lock);
+	mutex_init(&par->cmd_lock);
+	mutex_init(&par->burn_in_lock);
+	mutex_init(&par->anim_lock);
+	hrtimer_init(&par->anim_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	par->anim_timer.function = ssd1322fb_anim_tick;
+	spin_lock_init(&par->damage_lock);
+	retval = ssd1322fb_read_geometry(par);
+	if (retval)
+		goto err_alloc;
+	retval = -ENOMEM;
+	// Extra screen pages let user space draw off-screen and flip
+	if (device_property_read_u32(&spi->dev, "ssd,num-pages", &num_pages))
+		num_pages = SSD1322_DEFAULT_PAGES;
+	num_pages = clamp_t(u32, num_pages, 1, SSD1322_MAX_PAGES);
+	// Sized for the widest pixel format
+	page_len = par->width * par->height * SSD1322_MAX_BPP / 8;
+
 	// Allocate buffer for grayscale
-	par->buf = vzalloc(SSD1322_WIDTH * SSD1322_HEIGHT / 2);
+	// Whole pages are allocated so the buffer can be mapped to user space
+	par->num_pages = num_pages;
+	par->buf_len = page_len * num_pages;
+	par->buf = vzalloc(PAGE_ALIGN(par->buf_len));
 	if (!par->buf)
 		goto err_alloc;
 
 	// Zero out the framebuffer memory
-	memset(par->buf, 0, SSD1322_WIDTH * SSD1322_HEIGHT / 2);
+	memset(par->buf, 0, par->buf_len);
+
+	// Copy of the panel contents, unknown until the first update
+	par->shadow = vzalloc(par->width * par->height / 2);
+	if (!par->shadow)
+		goto err_shadow;
+	bitmap_fill(par->shadow_stale, par->height);
+	par->pitch = par->width / 2;
+	par->bpp = 4;
+
+	// Formats other than 4 bits per pixel are converted into this buffer
+	par->gray = vzalloc(par->width * par->height / 2);
+	if (!par->gray)
+		goto err_gray;
+
+	// Controllers that shift out 9-bit words take the D/C bit as part of
+	// the word, everyone else gets the words packed in software. An empty
+	// mask does not say anything about 9-bit support.
+	par->native_9bit = !!(spi->controller->bits_per_word_mask &
+			      SPI_BPW_MASK(9));
+	par->bits_per_word = par->native_9bit ? 9 : 8;
+
+	// Commands, including the init sequence, run at spi-max-frequency
+	// unless slowed down. Pixel streams can run faster than that.
+	if (device_property_read_u32(&spi->dev, "ssd,cmd-speed-hz",
+				     &par->cmd_speed_hz))
+		par->cmd_speed_hz = 0;
+	if (device_property_read_u32(&spi->dev, "ssd,pixel-speed-hz",
+				     &par->pixel_speed_hz))
+		par->pixel_speed_hz = 0;
+	// A full screen window is the largest frame: two bytes per column
+	// address and row, plus the D/C bit of every word
+	words = par->width / par->pixels_per_col * SSD1322_WORDS_PER_COL *
+		par->height;
+	par->tx_buf_len = par->native_9bit ? words * sizeof(u16) :
+					     DIV_ROUND_UP(words * 9, 8);
+
+	// Transfer buffers are sized once for the largest frame, so updates
+	// never allocate. kmalloc memory is DMA-safe and cacheline aligned.
+	// Two frames let the next one be encoded while one is on the bus.
+	par->cmd_buf = kmalloc(SSD1322_CMD_BUF_LEN, GFP_KERNEL);
+	if (!par->cmd_buf)
+		goto err_xfer;
+	retval = ssd1322_build_init(par);
+	if (retval)
+		goto err_xfer;
+	// Controllers with a transfer size limit, or a PIO/DMA threshold, get
+	// the frame in chunks of whole DMA cache lines, one message per frame
+	// so CS only toggles where the windows need it
+	par->max_msg = spi_max_message_size(spi);
+	par->max_chunk = spi_max_transfer_size(spi);
+	if (par->max_chunk >= SSD1322_CHUNK_ALIGN)
+		par->max_chunk = round_down(par->max_chunk,
+					    SSD1322_CHUNK_ALIGN);
+	else
+		par->max_chunk = round_down(par->max_chunk, sizeof(u16));
+	// A message must carry at least the start line, one window header
+	// and one full row, or no frame could make progress
+	full_row.x2 = par->width;
+	full_row.y2 = 1;
+	if (!par->max_chunk ||
+	    par->max_msg < SSD1322_WINDOW_HEADER_LEN * 2 +
+			   ssd1322fb_window_len(par, &full_row)) {
+		dev_err(&spi->dev,
+			"SPI transfers limited to %zu bytes, messages to %zu\n",
+			par->max_chunk, par->max_msg);
+		retval = -EINVAL;
+		goto err_xfer;
+	}
+
+	retval = -ENOMEM;
+	for (i = 0; i < ARRAY_SIZE(par->frames); i++) {
+		par->frames[i].par = par;
+		par->frames[i].index = i;
+		// Idle frames count as completed
+		init_completion(&par->frames[i].done);
+		complete_all(&par->frames[i].done);
+		par->frames[i].buf = kmalloc(SSD1322_FRAME_HEADER_LEN +
+						     SSD1322_FRAME_ALIGN_LEN +
+						     par->tx_buf_len,
+					     GFP_KERNEL);
+		if (!par->frames[i].buf)
+			goto err_xfer;
+		// Command bursts are chunked like the pixel streams, and every
+		// stream can add a partial chunk
+		par->frames[i].nxfers = SSD1322_FRAME_HEADERS *
+					DIV_ROUND_UP(SSD1322_WINDOW_HEADER_LEN,
+						     par->max_chunk) +
+					SSD1322_FRAME_STREAMS +
+					DIV_ROUND_UP(par->tx_buf_len,
+						     par->max_chunk);
+		par->frames[i].xfers = kcalloc(par->frames[i].nxfers,
+					       sizeof(struct spi_transfer),
+					       GFP_KERNEL);
+		if (!par->frames[i].xfers)
+			goto err_xfer;
+	}
+
+	// Flushes run on their own thread, so their latency does not depend
+	// on the system workqueue. Boards sharing the bus with time-critical
+	// devices can give it a real-time policy and hold the bus per frame.
+	par->kworker = kthread_create_worker(0, "ssd1322fb-%s",
+					     dev_name(&spi->dev));
+	if (IS_ERR(par->kworker)) {
+		retval = PTR_ERR(par->kworker);
+		goto err_xfer;
+	}
+	kthread_init_delayed_work(&par->flush_work, ssd1322fb_flush_work);
+	init_waitqueue_head(&par->frame_wq);
+	if (device_property_read_string(&spi->dev, "ssd,flush-sched",
+					&sched_name))
+		sched_name = ssd1322fb_sched_names[SSD1322_SCHED_NORMAL];
+	if (device_property_read_u32(&spi->dev, "ssd,flush-nice", &sched_nice))
+		sched_nice = 0;
+	retval = ssd1322fb_set_sched(par,
+				     match_string(ssd1322fb_sched_names,
+						  ARRAY_SIZE(ssd1322fb_sched_names),
+						  sched_name),
+				     (s32)sched_nice);
+	if (retval) {
+		dev_err(&spi->dev, "Invalid flush scheduling %s %d\n",
+			sched_name, (s32)sched_nice);
+		goto err_worker;
+	}
+	par->bus_lock = device_property_read_bool(&spi->dev, "ssd,bus-lock");
 
 	info->screen_base = par->buf;
 	info->fbops = &ssd1322fb_ops;
-	info->var.xres = SSD1322_WIDTH;
-	info->var.yres = SSD1322_HEIGHT;
+	info->var.xres = par->width;
+	info->var.yres = par->height;
+	info->var.xres_virtual = par->width;
+	info->var.yres_virtual = par->height * num_pages;
 	info->var.bits_per_pixel = 4; // 4 bits per pixel for grayscale
-	info->fix.line_length = SSD1322_WIDTH / 2;
-	info->fix.smem_len = SSD1322_WIDTH * SSD1322_HEIGHT / 2;
+	info->fix.line_length = par->width / 2;
+	info->fix.smem_len = info->fix.line_length * par->height * num_pages;
+	info->pseudo_palette = par->palette;
+	info->fix.visual = ssd1322fb_find_format(4)->visual;
+	ssd1322fb_check_var(&info->var, info);
+	// The color map starts as the linear ramp of the default gray table
+	retval = fb_alloc_cmap(&info->cmap, SSD1322_GRAYSCALE, 0);
+	if (retval)
+		goto err_worker;
+	for (i = 0; i < SSD1322_GRAYSCALE; i++) {
+		info->cmap.red[i] = i * 0x1111;
+		info->cmap.green[i] = i * 0x1111;
+		info->cmap.blue[i] = i * 0x1111;
+		par->cmap_levels[i] = i * SSD1322_GRAY_MAX /
+				      (SSD1322_GRAYSCALE - 1);
+	}
+	info->fix.ypanstep = 1;
+	info->fix.ywrapstep = 1;
+	info->flags |= FBINFO_HWACCEL_YWRAP;
+
+	// GDDRAM contents are unknown, so the first update sends everything
+	ssd1322fb_damage(par, 0, 0, par->width, par->height);
+
+	// Pages written through mmap are tracked and flushed after a delay
+	if (device_property_read_u32(&spi->dev, "ssd,flush-delay-ms",
+				     &flush_delay_ms))
+		flush_delay_ms = SSD1322_DEFAULT_FLUSH_DELAY_MS;
+	par->defio.delay = msecs_to_jiffies(flush_delay_ms);
+
+	// Back-to-back updates are merged and the frame rate is capped
+	if (device_property_read_u32(&spi->dev, "ssd,coalesce-us",
+				     &par->coalesce_us))
+		par->coalesce_us = SSD1322_DEFAULT_COALESCE_US;
+	par->coalesce_us = min_t(u32, par->coalesce_us,
+				 SSD1322_MAX_COALESCE_US);
+	if (device_property_read_u32(&spi->dev, "ssd,max-fps", &par->max_fps))
+		par->max_fps = SSD1322_DEFAULT_MAX_FPS;
+	par->max_fps = min_t(u32, par->max_fps, HZ);
+	par->last_flush = jiffies - HZ;
+	par->defio.deferred_io = ssd1322fb_deferred_io;
+	info->fbdefio = &par->defio;
+	// Page tracking is sized from smem_len, so it has to cover the memory
+	// of the widest format set_par can switch to
+	info->fix.smem_len = PAGE_ALIGN(par->buf_len);
+	retval = fb_deferred_io_init(info);
+	info->fix.smem_len = info->fix.line_length * par->height * num_pages;
+	if (retval)
+		goto err_cmap;
 
 	spi_set_drvdata(spi, info);
 
-	retval = register_framebuffer(info);
-	if (retval < 0)
-		goto err_fb;
-
-	dev_err(&spi->dev,
-		"fb%d: %s frame buffer device, using %d KiB of video memory\n",
-		info->node, info->fix.id, info->fix.smem_len >> 10);
-
+	// Bring up the panel before user space can open the device
 	retval = ssd1322_init(par);
 	if (retval)
-		goto err_fb;
+		goto err_defio;
+
+	// The panel sleeps once no frame was sent for the idle timeout. GDDRAM
+	// is kept, unless the board cuts its power in system sleep.
+	if (device_property_read_u32(&spi->dev, "ssd,idle-timeout-ms",
+				     &idle_timeout_ms))
+		idle_timeout_ms = SSD1322_DEFAULT_IDLE_TIMEOUT_MS;
+	par->keep_power = device_property_read_bool(&spi->dev,
+						    "ssd,keep-power-in-suspend");
+	pm_runtime_set_active(&spi->dev);
+	pm_runtime_set_autosuspend_delay(&spi->dev,
+					 idle_timeout_ms ?
+						 min_t(u32, idle_timeout_ms,
+						       INT_MAX) :
+						 -1);
+	pm_runtime_use_autosuspend(&spi->dev);
+	pm_runtime_enable(&spi->dev);
+
+	retval = ssd1322fb_register(par);
+	if (retval < 0)
+		goto err_pm;
+
+	dev_info(&spi->dev, "using %s 9-bit transfers\n",
+		 par->native_9bit ? "native" : "packed");
+	ssd1322fb_debugfs_init(par);
 
 	return 0;
 
-err_fb:
+err_pm:
+	// A failed registration may still have queued an update
+	ssd1322fb_stop(par);
+	pm_runtime_disable(&spi->dev);
+	pm_runtime_dont_use_autosuspend(&spi->dev);
+err_defio:
+	fb_deferred_io_cleanup(info);
+err_cmap:
+	fb_dealloc_cmap(&info->cmap);
+err_worker:
+	kthread_destroy_worker(par->kworker);
+err_xfer:
+	for (i = 0; i < ARRAY_SIZE(par->frames); i++) {
+		kfree(par->frames[i].buf);
+		kfree(par->frames[i].xfers);
+	}
+	kfree(par->init_buf);
+	kfree(par->cmd_buf);
+	vfree(par->gray);
+err_gray:
+	vfree(par->shadow);
+err_shadow:
 	vfree(par->buf);
 err_alloc:
+	mutex_destroy(&par->anim_lock);
+	mutex_destroy(&par->burn_in_lock);
+	mutex_destroy(&par->cmd_lock);
+	mutex_destroy(&par->lock);
 	framebuffer_release(info);
 	return retval;
 }
@@ -448,9 +3887,35 @@ static void ssd1322fb_remove(struct spi_device *spi)
 {
 	struct fb_info *info = spi_get_drvdata(spi);
 	struct ssd1322fb_par *par = info->par;
-
-	unregister_framebuffer(info);
+	int i;
+
+	debugfs_remove_recursive(par->debugfs);
+	ssd1322fb_unregister(par);
+	fb_deferred_io_cleanup(info);
+	hrtimer_cancel(&par->anim_timer);
+
+	// Stop requeueing and let the frames on the bus drain
+	ssd1322fb_stop(par);
+	pm_runtime_disable(&spi->dev);
+	pm_runtime_dont_use_autosuspend(&spi->dev);
+	kthread_destroy_worker(par->kworker);
+
+	for (i = 0; i < ARRAY_SIZE(par->frames); i++) {
+		kfree(par->frames[i].buf);
+		kfree(par->frames[i].xfers);
+	}
+	fb_dealloc_cmap(&info->cmap);
+	kfree(par->init_buf);
+	kfree(par->cmd_buf);
+	vfree(par->burn_in);
+	vfree(par->anim);
+	vfree(par->gray);
+	vfree(par->shadow);
 	vfree(par->buf);
+	mutex_destroy(&par->anim_lock);
+	mutex_destroy(&par->burn_in_lock);
+	mutex_destroy(&par->cmd_lock);
+	mutex_destroy(&par->lock);
 	framebuffer_release(info);
 }
 
@@ -474,6 +3939,8 @@ static struct spi_driver ssd1322fb_driver = {
         .name   = "ssd1322fb",
         .owner  = THIS_MODULE,
         .of_match_table = ssd1322fb_of_match,
+        .pm     = &ssd1322fb_pm_ops,
+        .dev_groups = ssd1322fb_attr_groups,
     },
     .probe  = ssd1322fb_probe,
     .remove = ssd1322fb_remove,
@@ -484,3 +3951,7 @@ module_spi_driver(ssd1322fb_driver);
 MODULE_DESCRIPTION("SSD1322 Framebuffer Driver");
 MODULE_AUTHOR("Jacob Levinson");
 MODULE_LICENSE("GPL");
+
+#ifdef SSD1322_KUNIT
+#include "ssd1322fb_test.c"
+#endif
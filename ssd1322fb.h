@@ -21,6 +21,7 @@
  * - Provides framebuffer support for SSD1322 OLED displays.
  * - Configurable resolution set to 128x64 pixels with 4-bit grayscale.
  * - Supports basic framebuffer operations.
+ * - mmap support through deferred I/O.
  * - NHD-2.7-12864WDXX
  *
  * Requirements:
@@ -46,13 +47,131 @@
 
 #include <linux/spi/spi.h>
 #include <linux/fb.h>
+#include <linux/hrtimer.h>
 #include <linux/module.h>
 #include <linux/delay.h>
+#include <linux/kthread.h>
+#include <linux/bitmap.h>
+#include <linux/cache.h>
+#include <linux/completion.h>
+#include <linux/debugfs.h>
+#include <linux/mutex.h>
+#include <linux/pm_runtime.h>
+#include <linux/sched.h>
+#include <linux/property.h>
+#include <linux/spinlock.h>
+#include <linux/sysfs.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+
+#include "ssd1322fb_ioctl.h"
+#include <linux/vmalloc.h>
+
+#ifdef SSD1322_DRM
+#include <drm/drm_atomic_helper.h>
+#include <drm/drm_connector.h>
+#include <drm/drm_damage_helper.h>
+#include <drm/drm_drv.h>
+#include <drm/drm_fbdev_generic.h>
+#include <drm/drm_fourcc.h>
+#include <drm/drm_gem_atomic_helper.h>
+#include <drm/drm_gem_framebuffer_helper.h>
+#include <drm/drm_gem_shmem_helper.h>
+#include <drm/drm_managed.h>
+#include <drm/drm_modeset_helper_vtables.h>
+#include <drm/drm_probe_helper.h>
+#include <drm/drm_simple_kms_helper.h>
+#endif
 
 // Macros for SSD1322 Display
+// Default geometry, the NHD-2.7-12864WD. Others come from the device tree.
 #define SSD1322_WIDTH 128
 #define SSD1322_HEIGHT 64
 #define SSD1322_GRAYSCALE 16
+#define SSD1322_WIDTH_MM 61
+#define SSD1322_HEIGHT_MM 31
+
+// First GDDRAM column address used by the default panel
+#define SSD1322_COL_START 0x1C
+// GDDRAM column addresses, 4 GDDRAM pixels each
+#define SSD1322_GDDRAM_COLS 120
+// GDDRAM rows, the display start line wraps around them
+#define SSD1322_GDDRAM_ROWS 128
+// Largest panel the controller drives
+#define SSD1322_MAX_WIDTH (SSD1322_GDDRAM_COLS * 4)
+#define SSD1322_MAX_HEIGHT SSD1322_GDDRAM_ROWS
+// Panel pixels per column address, with and without each pixel duplicated
+// into a whole GDDRAM byte
+#define SSD1322_PIXELS_PER_COL_DUP 2
+#define SSD1322_PIXELS_PER_COL_NATIVE 4
+// 9-bit words sent per column address and row (two GDDRAM bytes)
+#define SSD1322_WORDS_PER_COL 2
+
+// Words needed to open a window: column, row and write RAM commands
+#define SSD1322_WINDOW_COST 7
+// Maximum number of windows sent per display update
+#define SSD1322_MAX_WINDOWS 16
+// Maximum number of changed spans tracked per row
+#define SSD1322_MAX_SPANS 8
+
+// 3-wire SPI packs eight 9-bit words (D/C bit + byte) into nine bytes
+#define SSD1322_PACK9_BLOCK_WORDS 8
+#define SSD1322_PACK9_BLOCK_BYTES 9
+
+// Scratch buffer for command transfers, enough for the gray table upload
+#define SSD1322_CMD_BUF_LEN 64
+// Command burst opening a window, packed or as native 9-bit words
+#define SSD1322_WINDOW_HEADER_LEN (SSD1322_WINDOW_COST * sizeof(u16))
+// Command bursts per frame: one per window, one more for a window split
+// where GDDRAM wraps and one for the start line command
+#define SSD1322_FRAME_HEADERS (SSD1322_MAX_WINDOWS + 2)
+#define SSD1322_FRAME_HEADER_LEN \
+        (SSD1322_FRAME_HEADERS * SSD1322_WINDOW_HEADER_LEN)
+// Pixel streams per frame, one per window including the wrap split
+#define SSD1322_FRAME_STREAMS (SSD1322_MAX_WINDOWS + 1)
+// Pixel streams start on a DMA cache line and are chunked in whole lines, so
+// every chunk is mapped without bouncing
+#define SSD1322_CHUNK_ALIGN ARCH_DMA_MINALIGN
+// Room to align the pixel stream of every window of a frame
+#define SSD1322_FRAME_ALIGN_LEN (SSD1322_FRAME_STREAMS * SSD1322_CHUNK_ALIGN)
+
+// Framebuffer bytes encoded per block, duplicated (4 x 18 bits = 9 bytes)
+// or not (8 x 9 bits)
+#define SSD1322_ENC_GROUP 4
+#define SSD1322_ENC_GROUP_NATIVE SSD1322_PACK9_BLOCK_WORDS
+
+// Widest pixel format accepted from user space (XRGB8888)
+#define SSD1322_MAX_BPP 32
+// Longest gray level pulse, in display clocks
+#define SSD1322_GRAY_MAX 180
+
+// Most panels combined into one tiled framebuffer
+#define SSD1322_MAX_TILES 4
+
+// Console colors kept for the RGB formats
+#define SSD1322_PALETTE_LEN 16
+
+// Screen pages in the framebuffer memory, for off-screen drawing and flips
+#define SSD1322_DEFAULT_PAGES 2
+#define SSD1322_MAX_PAGES 3
+
+// Default delay between the first mmap write and the display update
+#define SSD1322_DEFAULT_FLUSH_DELAY_MS 50
+// Default window in which back-to-back updates are merged into one frame
+#define SSD1322_DEFAULT_COALESCE_US 5000
+#define SSD1322_MAX_COALESCE_US 1000000
+// Default refresh rate cap, 0 for no limit
+#define SSD1322_DEFAULT_MAX_FPS 60
+// Default idle time before the panel goes to sleep, 0 to never sleep
+#define SSD1322_DEFAULT_IDLE_TIMEOUT_MS 0
+// Longest wait for a flush to reach the panel
+#define SSD1322_FLUSH_TIMEOUT_MS 1000
+// Buckets of the log2 latency histograms, in microseconds
+#define SSD1322_HIST_BUCKETS 24
+
+// Largest animation ring and frame rate
+#define SSD1322_ANIM_MAX_LEN (1 << 20)
+#define SSD1322_ANIM_MAX_FPS 1000
 
 // SSD1322 command definitions
 #define SSD1322_CMD_DISPLAY_OFF 0xAE
@@ -70,10 +189,14 @@
 #define SSD1322_CMD_EXTERNAL_VSL 0xB4
 #define SSD1322_CMD_VCOMH_VOLTAGE 0xBE
 #define SSD1322_CMD_DISPLAY_MODE 0xA6
+#define SSD1322_CMD_ENTER_PARTIAL_DISPLAY 0xA8
 #define SSD1322_CMD_EXIT_PARTIAL_DISPLAY 0xA9
 #define SSD1322_CMD_DISPLAY_ENHANCEMENT 0xD1
 #define SSD1322_CMD_SET_GPIO 0xB5
 #define SSD1322_CMD_DEFAULT_GRAYSCALE 0xB9
+#define SSD1322_CMD_SET_GRAYSCALE_TABLE 0xB8
+#define SSD1322_CMD_ENABLE_GRAYSCALE_TABLE 0x00
+#define SSD1322_CMD_DISPLAY_INVERSE 0xA7
 #define SSD1322_CMD_SECOND_PRECHARGE 0xB6
 #define SSD1322_CMD_DISPLAY_ON 0xAF
 #define SSD1322_CMD_SET_COLUMN_ADDR 0x15
@@ -99,14 +222,203 @@
 #define GPIO_SETTING 0x00
 #define SECOND_PRECHARGE_PERIOD 0x08
 
+// Rectangle in panel pixels, x2 and y2 are exclusive. Empty when x1 >= x2.
+struct ssd1322fb_rect
+{
+        u32 x1, y1;
+        u32 x2, y2;
+};
+
+// State of the pixel stream encoder, carried across the rows of a window
+struct ssd1322_enc
+{
+        u8 *start;              // Start of the output buffer
+        u8 *out;                // Next output byte
+        u8 pending[SSD1322_ENC_GROUP_NATIVE]; // Bytes waiting for a group
+        unsigned int npending;  // Number of bytes in pending
+        bool native;            // Emit u16 words instead of packed bits
+        bool dup;               // Each pixel fills a whole GDDRAM byte
+};
+
+// Scheduling of the flush thread. Modules can only pick the RT priorities
+// the scheduler offers through sched_set_fifo*().
+enum ssd1322fb_sched
+{
+        SSD1322_SCHED_NORMAL,   // SCHED_NORMAL at sched_nice
+        SSD1322_SCHED_FIFO_LOW, // SCHED_FIFO at the lowest priority
+        SSD1322_SCHED_FIFO,     // SCHED_FIFO at the default driver priority
+};
+
+// Display update counters
+struct ssd1322fb_stats
+{
+        u64 frames_flushed;     // Updates that sent at least one window
+        u64 frames_skipped;     // Damaged updates identical to the panel
+        u64 transfer_errors;    // Frames that failed on the bus
+        u64 frames_split;       // Frames cut short by the message size limit
+        u64 bytes_on_wire;      // Bytes of all completed frames
+        u64 encode_ns;          // Time spent diffing and encoding frames
+        u64 transfer_ns;        // Time from queueing to completing frames
+        u64 alloc_failures;     // Failed allocations after probe
+        u32 latency_hist[SSD1322_HIST_BUCKETS]; // First damage to completion
+        u32 encode_hist[SSD1322_HIST_BUCKETS]; // Diff and encode per frame
+        u32 transfer_hist[SSD1322_HIST_BUCKETS]; // Queueing to completion
+        u64 updates_coalesced;  // Updates merged into an already queued flush
+};
+
+// Pixel format accepted through fb_check_var
+struct ssd1322fb_format
+{
+        u32 bpp;                // Bits per pixel
+        u32 visual;             // FB_VISUAL_* reported in the fixed info
+        u32 grayscale;          // Gray levels rather than RGB
+        struct fb_bitfield red, green, blue; // Channel layout of a pixel
+};
+
+struct ssd1322fb_par;
+
+// One encoded frame, in flight on the bus or ready to be encoded
+struct ssd1322fb_frame
+{
+        struct ssd1322fb_par *par; // Owning device
+        unsigned int index;     // Bit in par->frames_busy
+        unsigned long seq;      // Last damage sequence number in the frame
+        struct spi_message msg; // Message queued with spi_async()
+        struct spi_transfer *xfers; // Transfers of msg, nxfers entries
+        unsigned int nxfers;    // Transfers allocated for the largest frame
+        struct ssd1322fb_rect windows[SSD1322_MAX_WINDOWS + 1]; // Sent windows
+        int nwindows;           // Number of windows in the frame
+        ktime_t damage_time;    // First damage carried by the frame
+        ktime_t submit_time;    // Frame was handed to the SPI core
+        u8 *buf;                // DMA-safe command bursts and pixel data
+        struct completion done; // Signalled last when the frame completes
+};
+
 // Structure representing the SSD1322 framebuffer parameters
 struct ssd1322fb_par
 {
         struct spi_device *spi; // SPI device
         struct fb_info *info;   // Framebuffer info
         u8 *buf;                // Buffer for display data
+        size_t buf_len;         // Bytes allocated at buf, all pages at 32 bpp
+        u32 num_pages;          // Screen pages in the framebuffer memory
+        struct mutex lock;      // Serializes display updates
+        struct fb_deferred_io defio; // Deferred I/O state for mmap users
+        spinlock_t damage_lock; // Protects damage and sequence numbers
+        struct ssd1322fb_rect damage; // Area changed since the last update
+        unsigned long damage_seq; // Bumped by every damage submission
+        unsigned long done_seq; // Damage up to here is on the panel
+        ktime_t damage_start;   // First damage since the last update
+        unsigned long skip_seq; // Found identical while a frame was busy
+        unsigned long err_from; // Damage after err_from up to err_seq was
+        unsigned long err_seq;  // completed by the last failed frame
+        u32 yoffset;            // First framebuffer row of the visible page
+        u32 scan_yoffset;       // yoffset the current frame reads from
+        int scroll;             // Rows scrolled since the last update, up > 0
+        bool resync;            // A frame failed, resend everything
+        u32 start_line;         // GDDRAM row shown on the top panel row
+        bool start_line_dirty;  // start_line not yet sent to the panel
+        u32 partial_y;          // First row of the partial display band
+        u32 partial_height;     // Rows in the band, 0 for the full screen
+        u8 blit_lut[256][4];    // Glyph byte to 8 pixels in blit colors
+        u8 blit_fg, blit_bg;    // Colors blit_lut was built for
+        bool blit_lut_valid;    // blit_lut has been built
+        u32 bpp;                // Pixel format of buf, 4 for the panel's
+        u32 pitch;              // Bytes per row of shadow and gray
+        u8 *gray;               // buf converted to 4 bits, other formats
+        u32 palette[SSD1322_PALETTE_LEN]; // Pseudo palette for fbcon
+        u8 *shadow;             // Last frame sent to the panel
+        DECLARE_BITMAP(shadow_stale, SSD1322_MAX_HEIGHT); // Rows not in shadow
+        u32 width, height;      // Panel size in pixels
+        u32 col_start;          // First GDDRAM column address of the panel
+        bool dup;               // Each pixel is duplicated into a GDDRAM byte
+        u32 pixels_per_col;     // Pixels covered by one column address
+        u32 width_mm, height_mm; // Active area, reported through DRM
+        int (*diff_row)(struct ssd1322fb_par *par, u32 y, u32 x1, u32 x2,
+                        struct ssd1322fb_rect *spans, int max_spans);
+                                // Row diff, specialized for the geometry
+        struct ssd1322fb_stats stats; // Display update counters
+        u8 *cmd_buf;            // DMA-safe scratch for command transfers
+        struct mutex cmd_lock;  // Serializes cmd_buf and the gray table
+        u8 cmap_levels[SSD1322_GRAYSCALE]; // Gray level per pixel value, cmap
+        u8 gray_gs[SSD1322_GRAYSCALE]; // Rising table sent to the controller
+        bool gray_custom;       // gray_gs replaces the default linear table
+        bool gray_inverse;      // gray_gs is reversed, display is inverted
+        u8 *init_buf;           // Pre-encoded power-on command sequence
+        size_t init_len;        // Length of init_buf in bytes
+        size_t init_words;      // 9-bit words in init_buf
+        u8 init_cmd;            // First command of the init sequence
+        size_t tx_buf_len;      // Pixel data capacity of a frame
+        size_t max_chunk;       // Longest transfer the controller takes
+        size_t max_msg;         // Longest message the controller takes
+        bool native_9bit;       // Controller sends 9-bit words itself
+        u8 bits_per_word;       // Word size of every transfer
+        u32 cmd_speed_hz;       // SCLK for commands, 0 for spi-max-frequency
+        u32 pixel_speed_hz;     // SCLK for WRITE_RAM streams, 0 likewise
+        struct mutex burn_in_lock; // Serializes burn-in runs
+        u8 *burn_in;            // Test pattern shown instead, or NULL
+        u32 burn_in_frames;     // Frames sent by the last burn-in run
+        u64 burn_in_errors;     // Bus errors during the last burn-in run
+        struct mutex anim_lock; // Serializes loading and playback control
+        u8 *anim;               // Ring of animation frames, or NULL
+        u32 anim_frames;        // Frames in the ring
+        u32 anim_index;         // Frame on screen, under damage_lock
+        u32 anim_loops;         // Plays left, 0 for forever
+        bool anim_hold;         // Keep the last frame when playback ends
+        const u8 *anim_show;    // Frame to show, NULL when stopped
+        const u8 *scan_anim;    // anim_show when the update started
+        ktime_t anim_period;    // Time between frames
+        struct hrtimer anim_timer; // Advances the shown frame
+        struct ssd1322fb_frame frames[2]; // Double-buffered encoded frames
+        unsigned int next_frame; // Frame the next update is encoded into
+        unsigned long frames_busy; // Frames queued with spi_async()
+        wait_queue_head_t frame_wq; // Woken when a frame completes
+        struct kthread_worker *kworker; // Thread running the flushes
+        struct kthread_delayed_work flush_work; // Encodes and sends a frame
+        int sched_policy;       // SSD1322_SCHED_* of the flush thread
+        int sched_nice;         // Nice value under SSD1322_SCHED_NORMAL
+        bool bus_lock;          // Hold the SPI bus for each whole frame
+        struct dentry *debugfs; // Counters and histograms
+        u32 coalesce_us;        // Delay merging back-to-back updates
+        u32 max_fps;            // Refresh rate cap, 0 for no limit
+        unsigned long last_flush; // Jiffies when the last frame was queued
+        bool stopping;          // Device is going away or suspended
+        bool gddram_lost;       // Panel lost power, re-init on resume
+        bool keep_power;        // Board keeps the panel powered in sleep
+        struct ssd1322fb_tile *tile; // Tile group of the panel, or NULL
+        unsigned int tile_slot; // Grid position in the tile group
+#ifdef SSD1322_DRM
+        struct drm_device *drm; // DRM device registered instead of fbdev
+#endif
 };
 
+// Framebuffer spanning a grid of panels. Damage is copied into each panel's
+// own buffer and flushed through its own bus, so the panels update in
+// parallel.
+struct ssd1322fb_tile
+{
+        struct list_head node;  // Entry in ssd1322fb_tiles
+        u32 group;              // ssd,tile-group shared by the panels
+        u32 cols, rows;         // Panels across and down
+        u32 panel_width, panel_height; // Size of every panel in the group
+        struct ssd1322fb_par *panels[SSD1322_MAX_TILES]; // By grid position
+        unsigned int npanels;   // Panels probed so far
+        struct fb_info *info;   // Framebuffer over the grid, once complete
+        u8 *buf;                // Framebuffer memory, 4 bits per pixel
+        struct fb_deferred_io defio; // Tracking of pages written via mmap
+};
+
+#ifdef SSD1322_DRM
+// DRM device feeding the panel through the same update path as fbdev
+struct ssd1322_drm
+{
+        struct drm_device drm;  // DRM device, allocated with the struct
+        struct drm_simple_display_pipe pipe; // Plane, CRTC and encoder
+        struct drm_connector connector; // Fixed-mode SPI connector
+        struct ssd1322fb_par *par; // Driver state shared with fbdev
+};
+#endif
+
 // Device tree match table
 static const struct of_device_id ssd1322fb_of_match[];
 
@@ -115,12 +427,16 @@ static const struct of_device_id ssd1322fb_of_match[];
 /**
  * ssd1322fb_setcolreg - Set grayscale register
  * @regno: Register number
- * @red: Grayscale value (0-15)
- * @green: Grayscale value (0-15)
- * @blue: Grayscale value (0-15)
+ * @red: Red intensity (0-65535)
+ * @green: Green intensity (0-65535)
+ * @blue: Blue intensity (0-65535)
  * @transp: Transparency value
  * @info: Framebuffer info structure
  *
+ * For the RGB formats the color is stored in the pseudo palette used by the
+ * console. In the 4-bit format the luma of the color is kept as the gray
+ * level of the pixel value, sent to the panel by ssd1322fb_setcmap().
+ *
  * Return: 0 on success, negative error code on failure.
  */
 static int ssd1322fb_setcolreg(unsigned regno, unsigned red, unsigned green,
@@ -143,29 +459,732 @@ static int ssd1322fb_probe(struct spi_device *spi);
  */
 static void ssd1322fb_remove(struct spi_device *spi);
 
+/**
+ * ssd1322fb_register - Register the display with user space
+ * @par: Parameters for SSD1322 framebuffer
+ *
+ * Registers the fbdev device, or the DRM device when built with
+ * SSD1322_DRM=y. Panels with an ssd,tile-group property join their tile
+ * group instead.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+static int ssd1322fb_register(struct ssd1322fb_par *par);
+
+/**
+ * ssd1322fb_unregister - Unregister the display from user space
+ * @par: Parameters for SSD1322 framebuffer
+ */
+static void ssd1322fb_unregister(struct ssd1322fb_par *par);
+
+/**
+ * ssd1322fb_tile_damage - Pass damage of a tiled framebuffer to its panels
+ * @tile: Tile group
+ * @x: Left edge in pixels
+ * @y: Top edge in pixels
+ * @w: Width in pixels
+ * @h: Height in pixels
+ *
+ * Copies the damaged part of each panel into its buffer and schedules its
+ * flush. Safe to call from atomic context.
+ */
+static void ssd1322fb_tile_damage(struct ssd1322fb_tile *tile, u32 x, u32 y,
+                                  u32 w, u32 h);
+
+/**
+ * ssd1322fb_tile_write - Write to a tiled framebuffer
+ * @info: Framebuffer info structure
+ * @buf: User space buffer containing data to be written
+ * @count: Number of bytes to write
+ * @ppos: Offset in the framebuffer memory
+ *
+ * Return: Number of bytes written, or a negative error code.
+ */
+static ssize_t ssd1322fb_tile_write(struct fb_info *info,
+                                    const char __user *buf, size_t count,
+                                    loff_t *ppos);
+
+/**
+ * ssd1322fb_tile_fillrect - Fill a rectangle of a tiled framebuffer
+ * @info: Framebuffer info structure
+ * @rect: Rectangle to fill
+ */
+static void ssd1322fb_tile_fillrect(struct fb_info *info,
+                                    const struct fb_fillrect *rect);
+
+/**
+ * ssd1322fb_tile_copyarea - Copy an area of a tiled framebuffer
+ * @info: Framebuffer info structure
+ * @area: Source and destination of the copy
+ */
+static void ssd1322fb_tile_copyarea(struct fb_info *info,
+                                    const struct fb_copyarea *area);
+
+/**
+ * ssd1322fb_tile_imageblit - Draw an image into a tiled framebuffer
+ * @info: Framebuffer info structure
+ * @image: Image to draw, 1 bit glyphs or 8 bit palette indices
+ */
+static void ssd1322fb_tile_imageblit(struct fb_info *info,
+                                     const struct fb_image *image);
+
+/**
+ * ssd1322fb_tile_deferred_io - Flush pages of a tiled framebuffer
+ * @info: Framebuffer info structure
+ * @pagereflist: Pages written through mmap since the last call
+ */
+static void ssd1322fb_tile_deferred_io(struct fb_info *info,
+                                       struct list_head *pagereflist);
+
+/**
+ * ssd1322fb_tile_register - Register the framebuffer of a complete group
+ * @tile: Tile group with all of its panels probed
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+static int ssd1322fb_tile_register(struct ssd1322fb_tile *tile);
+
+/**
+ * ssd1322fb_tile_unregister - Remove the framebuffer of a group
+ * @tile: Tile group
+ */
+static void ssd1322fb_tile_unregister(struct ssd1322fb_tile *tile);
+
+/**
+ * ssd1322fb_tile_add - Add a panel to its tile group
+ * @par: Parameters for SSD1322 framebuffer
+ *
+ * Reads ssd,tile-group, ssd,tile-grid and ssd,tile-position. The last panel
+ * of a group to probe registers the framebuffer over the whole grid.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+static int ssd1322fb_tile_add(struct ssd1322fb_par *par);
+
+/**
+ * ssd1322fb_tile_remove - Take a panel out of its tile group
+ * @par: Parameters for SSD1322 framebuffer
+ *
+ * The framebuffer of the group goes away with its first panel.
+ */
+static void ssd1322fb_tile_remove(struct ssd1322fb_par *par);
+
+#ifdef SSD1322_DRM
+/**
+ * ssd1322_drm_blit - Convert a damage clip of a DRM framebuffer
+ * @par: Parameters for SSD1322 framebuffer
+ * @vaddr: Mapping of the XRGB8888 framebuffer
+ * @fb: DRM framebuffer
+ * @clip: Damaged area, widened to whole framebuffer bytes
+ *
+ * Converts the clip to 4-bit gray in the driver framebuffer and damages it,
+ * so it goes out with the next display update.
+ */
+static void ssd1322_drm_blit(struct ssd1322fb_par *par, const void *vaddr,
+                             const struct drm_framebuffer *fb,
+                             const struct drm_rect *clip);
+
+/**
+ * ssd1322_drm_enable - Send the whole frame when the pipe is enabled
+ * @pipe: Display pipe
+ * @crtc_state: New CRTC state
+ * @plane_state: New plane state
+ */
+static void ssd1322_drm_enable(struct drm_simple_display_pipe *pipe,
+                               struct drm_crtc_state *crtc_state,
+                               struct drm_plane_state *plane_state);
+
+/**
+ * ssd1322_drm_update - Send the damage clips of a plane update
+ * @pipe: Display pipe
+ * @old_state: Previous plane state, for the damage iterator
+ */
+static void ssd1322_drm_update(struct drm_simple_display_pipe *pipe,
+                               struct drm_plane_state *old_state);
+
+/**
+ * ssd1322_drm_get_modes - Report the fixed panel mode
+ * @connector: SPI connector
+ *
+ * Return: Number of modes added.
+ */
+static int ssd1322_drm_get_modes(struct drm_connector *connector);
+
+/**
+ * ssd1322_drm_register - Create and register the DRM device
+ * @par: Parameters for SSD1322 framebuffer
+ *
+ * Sets up a simple display pipe with shadow-plane XRGB8888 framebuffers and
+ * damage clips, and fbdev emulation for legacy users. The DRM device is
+ * device-managed.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+static int ssd1322_drm_register(struct ssd1322fb_par *par);
+
+/**
+ * ssd1322_drm_unregister - Unplug the DRM device and switch the pipe off
+ * @par: Parameters for SSD1322 framebuffer
+ */
+static void ssd1322_drm_unregister(struct ssd1322fb_par *par);
+#endif
+
+/**
+ * ssd1322fb_runtime_suspend - Put the idle panel to sleep
+ * @dev: SPI device
+ *
+ * Turns the display off. GDDRAM keeps its contents while the panel is
+ * powered, so no frame has to be resent on wake.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+static int ssd1322fb_runtime_suspend(struct device *dev);
+
+/**
+ * ssd1322fb_runtime_resume - Wake the panel for the next frame
+ * @dev: SPI device
+ *
+ * Turns the display back on. If the panel lost power, it is initialized again
+ * and the next update resends the whole screen.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+static int ssd1322fb_runtime_resume(struct device *dev);
+
+/**
+ * ssd1322fb_suspend - Stop updates for system sleep
+ * @dev: SPI device
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+static int ssd1322fb_suspend(struct device *dev);
+
+/**
+ * ssd1322fb_resume - Restart updates after system sleep
+ * @dev: SPI device
+ *
+ * Unless "ssd,keep-power-in-suspend" is set, GDDRAM is assumed lost and the
+ * panel is initialized again when it is next woken.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+static int ssd1322fb_resume(struct device *dev);
+
+/**
+ * ssd1322_build_init - Encode the power-on command sequence
+ * @par: Parameters for SSD1322 framebuffer
+ *
+ * Encodes the built-in command table, or the "ssd,init-sequence" device tree
+ * property when present, into init_buf in the selected transfer format. Both
+ * use the same layout: a command byte, the number of data bytes, then the data
+ * bytes, repeated.
+ *
+ * Return: 0 on success, -EINVAL for a truncated sequence, -ENOMEM.
+ */
+static int ssd1322_build_init(struct ssd1322fb_par *par);
+
 /**
  * ssd1322_init - Initialize SSD1322 display
  * @par: Parameters for SSD1322 framebuffer
  *
  * This function initializes the SSD1322 display controller by sending the
- * necessary commands over the SPI bus. It configures the display settings and
- * prepares it for framebuffer updates.
+ * sequence prepared by ssd1322_build_init() over the SPI bus in a single
+ * transfer. It configures the display settings and prepares it for
+ * framebuffer updates.
  *
  * Return: 0 on success, negative error code on failure.
  */
 static int ssd1322_init(struct ssd1322fb_par *par);
 
+/**
+ * ssd1322fb_damage - Mark an area of the framebuffer as changed
+ * @par: Parameters for SSD1322 framebuffer
+ * @x: Left edge in pixels
+ * @y: Top edge in pixels
+ * @w: Width in pixels
+ * @h: Height in pixels
+ *
+ * The area is clipped to the visible screen and merged into the damage
+ * rectangle sent by the next display update. Safe to call from atomic context.
+ */
+static void ssd1322fb_damage(struct ssd1322fb_par *par, u32 x, u32 y, u32 w,
+                             u32 h);
+
+/**
+ * ssd1322fb_damage_area - Mark an area of the virtual framebuffer as changed
+ * @par: Parameters for SSD1322 framebuffer
+ * @x: Left edge in pixels
+ * @y: Top edge in pixels, counted from the start of the framebuffer memory
+ * @w: Width in pixels
+ * @h: Height in pixels
+ *
+ * Translates the area to the visible page before calling ssd1322fb_damage(),
+ * wrapping around the end of the framebuffer memory for ywrap panning. Areas
+ * outside the visible page are ignored.
+ */
+static void ssd1322fb_damage_area(struct ssd1322fb_par *par, u32 x, u32 y,
+                                  u32 w, u32 h);
+
+/**
+ * ssd1322fb_damage_range - Mark a byte range of the framebuffer as changed
+ * @par: Parameters for SSD1322 framebuffer
+ * @offset: Byte offset into the framebuffer memory
+ * @len: Number of bytes changed
+ *
+ * A range inside a single row damages only the pixels it covers, a range
+ * spanning several rows damages those rows entirely.
+ */
+static void ssd1322fb_damage_range(struct ssd1322fb_par *par, size_t offset,
+                                   size_t len);
+
+/**
+ * ssd1322fb_scroll_locked - Record a hardware scroll of the visible screen
+ * @par: Parameters for SSD1322 framebuffer
+ * @rows: Rows the contents moved up by, negative for down
+ *
+ * The scroll is applied by the next display update, pending damage is moved
+ * along with the contents. Called with damage_lock held.
+ */
+static void ssd1322fb_scroll_locked(struct ssd1322fb_par *par, int rows);
+
+/**
+ * ssd1322fb_apply_scroll - Move the display start line for a scroll
+ * @par: Parameters for SSD1322 framebuffer
+ * @rows: Rows the contents moved up by, negative for down
+ * @rect: Damage of the update, extended by the rows scrolled in
+ *
+ * Rotates the shadow frame the way the start line rotates GDDRAM and marks the
+ * rows scrolled in as stale. A scroll by a whole screen or more only marks
+ * everything stale. Called with the display lock held.
+ */
+static void ssd1322fb_apply_scroll(struct ssd1322fb_par *par, int rows,
+                                   struct ssd1322fb_rect *rect);
+
+/**
+ * ssd1322fb_scanout_row - Framebuffer row shown on a panel row
+ * @par: Parameters for SSD1322 framebuffer
+ * @y: Panel row
+ *
+ * Return: Start of the row in the framebuffer memory for the current frame.
+ */
+static const u8 *ssd1322fb_scanout_row(struct ssd1322fb_par *par, u32 y);
+
+/**
+ * ssd1322fb_gddram_row - GDDRAM row shown on a panel row
+ * @par: Parameters for SSD1322 framebuffer
+ * @y: Panel row
+ *
+ * Return: GDDRAM row address under the current display start line.
+ */
+static u32 ssd1322fb_gddram_row(struct ssd1322fb_par *par, u32 y);
+
+/**
+ * ssd1322_conv_mono - Convert 1-bit pixels to 4-bit gray
+ * @dst: Output, two pixels per byte
+ * @src: Start of the source row
+ * @x: First pixel, even
+ * @n: Number of output bytes
+ *
+ * ssd1322_conv_gray8(), ssd1322_conv_rgb565() and ssd1322_conv_xrgb8888() take
+ * the same arguments for their formats.
+ */
+static void ssd1322_conv_mono(u8 *dst, const u8 *src, u32 x, u32 n);
+static void ssd1322_conv_gray8(u8 *dst, const u8 *src, u32 x, u32 n);
+static void ssd1322_conv_rgb565(u8 *dst, const u8 *src, u32 x, u32 n);
+static void ssd1322_conv_xrgb8888(u8 *dst, const u8 *src, u32 x, u32 n);
+
+/**
+ * ssd1322fb_convert - Convert the damaged area to the panel format
+ * @par: Parameters for SSD1322 framebuffer
+ * @rect: Damaged area, aligned to whole column addresses
+ *
+ * Converts the damaged pixels of the visible page into the 4-bit gray buffer
+ * the display update reads from, using the luma kernel of the current format.
+ * Stale rows are converted whole, since they are sent whole.
+ */
+static void ssd1322fb_convert(struct ssd1322fb_par *par,
+                              const struct ssd1322fb_rect *rect);
+
+/**
+ * ssd1322fb_read_geometry - Read the panel geometry from the device tree
+ * @par: Parameters for SSD1322 framebuffer
+ *
+ * Reads ssd,width, ssd,height, ssd,col-offset and ssd,native-pixels, falling
+ * back to the NHD-2.7-12864WD, and picks the row diff for the geometry.
+ *
+ * Return: 0 on success, -EINVAL if the panel does not fit GDDRAM.
+ */
+static int ssd1322fb_read_geometry(struct ssd1322fb_par *par);
+
+/**
+ * ssd1322fb_diff_row_128x64 - Diff a row of a 128x64 duplicated panel
+ * @par: Parameters for SSD1322 framebuffer
+ * @y: Row
+ * @x1: First pixel to compare
+ * @x2: End of the pixels to compare
+ * @spans: Changed spans found in the row
+ * @max_spans: Size of @spans
+ *
+ * ssd1322fb_diff_row_256x64() and ssd1322fb_diff_row_any() take the same
+ * arguments, for 256x64 native panels and any other geometry. The first two
+ * let the compiler unroll the comparisons for constant column sizes.
+ *
+ * Return: Number of spans, after merging spans separated by short gaps.
+ */
+static int ssd1322fb_diff_row_128x64(struct ssd1322fb_par *par, u32 y, u32 x1,
+                                     u32 x2, struct ssd1322fb_rect *spans,
+                                     int max_spans);
+static int ssd1322fb_diff_row_256x64(struct ssd1322fb_par *par, u32 y, u32 x1,
+                                     u32 x2, struct ssd1322fb_rect *spans,
+                                     int max_spans);
+static int ssd1322fb_diff_row_any(struct ssd1322fb_par *par, u32 y, u32 x1,
+                                  u32 x2, struct ssd1322fb_rect *spans,
+                                  int max_spans);
+
+/**
+ * ssd1322fb_plan_windows - Choose the GDDRAM windows for an update
+ * @par: Parameters for SSD1322 framebuffer
+ * @rect: Damaged area, aligned to whole column addresses
+ * @windows: Array of SSD1322_MAX_WINDOWS entries receiving the windows
+ *
+ * Each damaged row is compared against the shadow frame to find the changed
+ * spans. Spans separated by a short gap, and spans on consecutive rows, are
+ * merged whenever resending the unchanged pixels costs fewer words than
+ * opening another window. Bands never cross the row where GDDRAM wraps.
+ *
+ * Return: Number of windows to send, 0 if the panel is already up to date.
+ */
+static int ssd1322fb_plan_windows(struct ssd1322fb_par *par,
+                                  const struct ssd1322fb_rect *rect,
+                                  struct ssd1322fb_rect *windows);
+
+/**
+ * ssd1322fb_add_chunks - Queue a buffer as transfers of at most max_chunk
+ * @par: Parameters for SSD1322 framebuffer
+ * @frame: Frame whose message receives the transfers
+ * @xfer: Next free transfer of the frame, advanced past the added ones
+ * @buf: Encoded words to send
+ * @len: Length of buf in bytes
+ * @speed_hz: SCLK for the chunks, 0 for spi-max-frequency
+ * @cs_change: Release CS after the last chunk
+ *
+ * CS stays asserted between the chunks, so the controller sees one stream.
+ */
+static void ssd1322fb_add_chunks(struct ssd1322fb_par *par,
+                                 struct ssd1322fb_frame *frame,
+                                 struct spi_transfer **xfer, const u8 *buf,
+                                 size_t len, u32 speed_hz, bool cs_change);
+
+/**
+ * ssd1322fb_encode_window - Encode one window of the framebuffer
+ * @par: Parameters for SSD1322 framebuffer
+ * @rect: Window to send, aligned to whole column addresses
+ * @header: Receives the column, row and write RAM command burst
+ * @data: Receives the pixel stream
+ *
+ * The window is copied into the shadow frame first and encoded from there, so
+ * the shadow always matches what was put on the wire.
+ *
+ * Return: Length of the pixel stream in bytes.
+ */
+static size_t ssd1322fb_encode_window(struct ssd1322fb_par *par,
+                                      const struct ssd1322fb_rect *rect,
+                                      u8 *header, u8 *data);
+
+/**
+ * ssd1322fb_frame_complete - Completion of a frame queued with spi_async()
+ * @context: The completed struct ssd1322fb_frame
+ *
+ * Releases the frame buffer and requeues the flush for damage that arrived
+ * during the transfer. On error the windows of the frame are marked stale.
+ * Runs in the context of the SPI controller, possibly atomic. Signalling
+ * frame->done is the last access to the device, teardown waits for it.
+ */
+static void ssd1322fb_frame_complete(void *context);
+
+/**
+ * ssd1322fb_stop - Stop updates and wait for the frames on the bus
+ * @par: Parameters for SSD1322 framebuffer
+ *
+ * Damage keeps accumulating but is not flushed until stopping is cleared.
+ * On return no frame completion is running or pending.
+ */
+static void ssd1322fb_stop(struct ssd1322fb_par *par);
+
 /**
  * ssd1322fb_update_display - Update the display with new framebuffer data
  * @par: Parameters for SSD1322 framebuffer
  *
- * This function sends the updated framebuffer data to the SSD1322 display over
- * the SPI bus.
+ * This function encodes the damaged area of the framebuffer into an idle frame
+ * and queues it on the SPI bus without waiting for the transfer. Only the
+ * parts that differ from the shadow frame are sent, and an update that changes
+ * nothing is skipped. If both frames are busy the damage is kept and sent once
+ * a frame completes. Called from the flush work.
  *
  * Return: 0 on success, negative error code on failure.
  */
 static int ssd1322fb_update_display(struct ssd1322fb_par *par);
 
+/**
+ * ssd1322fb_deferred_io - Flush pages dirtied through mmap
+ * @info: Framebuffer info structure
+ * @pagereflist: List of pages written since the last flush
+ *
+ * Called from the deferred I/O work once the flush delay has expired. All
+ * dirty pages collected during the delay are sent in a single display update.
+ */
+static void ssd1322fb_deferred_io(struct fb_info *info,
+                                  struct list_head *pagereflist);
+
+/**
+ * ssd1322fb_flush_delay - Delay before the next frame may start
+ * @par: Parameters for SSD1322 framebuffer
+ * @min_delay: Minimum delay in jiffies
+ *
+ * Return: @min_delay, or longer if the refresh rate cap requires it.
+ */
+static unsigned long ssd1322fb_flush_delay(struct ssd1322fb_par *par,
+                                           unsigned long min_delay);
+
+/**
+ * ssd1322fb_flush_now - Queue a display update without coalescing
+ * @par: Parameters for SSD1322 framebuffer
+ *
+ * Used by explicit flush requests. The refresh rate cap still applies.
+ */
+static void ssd1322fb_flush_now(struct ssd1322fb_par *par);
+
+/**
+ * ssd1322fb_wait_flush - Wait for damage to reach the panel
+ * @par: Parameters for SSD1322 framebuffer
+ * @seq: Damage sequence number to wait for
+ *
+ * Sleeps until the frame carrying all damage up to @seq has completed on the
+ * SPI bus, or was found identical to the panel contents.
+ *
+ * Return: 0 on success, -EIO if the frame that completed @seq failed,
+ * -ETIMEDOUT or -ERESTARTSYS if the wait was cut short.
+ */
+static int ssd1322fb_wait_flush(struct ssd1322fb_par *par, unsigned long seq);
+
+/**
+ * ssd1322fb_set_partial - Enter or leave partial display mode
+ * @par: Parameters for SSD1322 framebuffer
+ * @y: First row of the band
+ * @height: Rows in the band, 0 to show the full screen again
+ *
+ * Only the band is driven by the panel and only damage inside it is sent.
+ * Before the full screen is shown again the rows outside the band are
+ * brought up to date.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+static int ssd1322fb_set_partial(struct ssd1322fb_par *par, u32 y,
+                                 u32 height);
+
+/**
+ * ssd1322fb_set_sched - Set the scheduling of the flush thread
+ * @par: Parameters for SSD1322 framebuffer
+ * @policy: SSD1322_SCHED_* value
+ * @nice: Nice value, used with SSD1322_SCHED_NORMAL
+ *
+ * Return: 0 on success, -EINVAL for an unknown policy or nice value.
+ */
+static int ssd1322fb_set_sched(struct ssd1322fb_par *par, int policy,
+                               int nice);
+
+/**
+ * ssd1322fb_anim_load - Replace the ring of animation frames
+ * @par: Parameters for SSD1322 framebuffer
+ * @data: Frames in user memory, one screen of 4 bits per pixel each
+ * @nframes: Number of frames, 0 to free the ring
+ *
+ * Playback is stopped first. Called with anim_lock held.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+static int ssd1322fb_anim_load(struct ssd1322fb_par *par,
+                               const void __user *data, u32 nframes);
+
+/**
+ * ssd1322fb_anim_play - Start playing the ring of animation frames
+ * @par: Parameters for SSD1322 framebuffer
+ * @play: Frame rate, loop count and flags from user space
+ *
+ * Every frame is damaged as a whole and diffed against the shadow, so only
+ * what changed between frames is sent. Frames the bus cannot keep up with
+ * are dropped. Called with anim_lock held.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+static int ssd1322fb_anim_play(struct ssd1322fb_par *par,
+                               const struct ssd1322fb_anim_play *play);
+
+/**
+ * ssd1322fb_anim_stop - Stop playback and show the framebuffer again
+ * @par: Parameters for SSD1322 framebuffer
+ *
+ * Called with anim_lock held.
+ */
+static void ssd1322fb_anim_stop(struct ssd1322fb_par *par);
+
+/**
+ * ssd1322fb_hist_add - Count a duration in a log2 histogram
+ * @hist: SSD1322_HIST_BUCKETS buckets, bucket n counts durations below 2^n us
+ * @ns: Duration in nanoseconds
+ */
+static void ssd1322fb_hist_add(u32 *hist, u64 ns);
+
+/**
+ * ssd1322fb_debugfs_init - Create the debugfs directory of the device
+ * @par: Parameters for SSD1322 framebuffer
+ *
+ * Failures are not fatal, the driver works without debugfs.
+ */
+static void ssd1322fb_debugfs_init(struct ssd1322fb_par *par);
+
+/**
+ * ssd1322fb_fill_pattern - Draw one frame of the burn-in test pattern
+ * @par: Parameters for SSD1322 framebuffer
+ * @pattern: Buffer of the panel size, 4 bits per pixel
+ * @n: Frame number, moves the pattern along
+ */
+static void ssd1322fb_fill_pattern(struct ssd1322fb_par *par, u8 *pattern,
+                                   u32 n);
+
+/**
+ * ssd1322fb_burn_in - Send a run of test frames at the set clocks
+ * @par: Parameters for SSD1322 framebuffer
+ * @frames: Number of frames to send, 0 to show the framebuffer again
+ *
+ * The panel cannot be read back, so the last frame stays on screen to be
+ * checked by eye. Bus errors are counted and do not end the run. Called
+ * with burn_in_lock held.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+static int ssd1322fb_burn_in(struct ssd1322fb_par *par, u32 frames);
+
+/**
+ * ssd1322fb_find_format - Look up a supported pixel format
+ * @bpp: Bits per pixel
+ *
+ * Return: Format description, NULL if the format is not supported.
+ */
+static const struct ssd1322fb_format *ssd1322fb_find_format(u32 bpp);
+
+/**
+ * ssd1322fb_check_var - Validate a requested screen mode
+ * @var: Requested mode, adjusted to the nearest supported one
+ * @info: Framebuffer info structure
+ *
+ * Accepts 1, 4 and 8 bit gray, RGB565 and XRGB8888 at the panel resolution.
+ *
+ * Return: 0 on success, -EINVAL for an unsupported pixel format.
+ */
+static int ssd1322fb_check_var(struct fb_var_screeninfo *var,
+                               struct fb_info *info);
+
+/**
+ * ssd1322fb_set_par - Switch to the mode in info->var
+ * @info: Framebuffer info structure
+ *
+ * A new pixel format clears the framebuffer memory and the whole screen is
+ * sent again.
+ *
+ * Return: 0 on success, -EINVAL for an unsupported pixel format.
+ */
+static int ssd1322fb_set_par(struct fb_info *info);
+
+/**
+ * ssd1322fb_pan_display - Select the page shown on the panel
+ * @var: Screen info holding the new yoffset
+ * @info: Framebuffer info structure
+ *
+ * Following frames are read from the new page. Panning by less than a screen
+ * moves the display start line and only sends the rows panned in. Combined
+ * with the shadow diff, a flip only sends the rows that differ between the old
+ * and the new page. FB_VMODE_YWRAP offsets wrap around the framebuffer memory.
+ *
+ * Return: 0 on success, -EINVAL if the offset is out of range.
+ */
+static int ssd1322fb_pan_display(struct fb_var_screeninfo *var,
+                                 struct fb_info *info);
+
+/**
+ * ssd1322fb_ioctl - Handle framebuffer ioctls
+ * @info: Framebuffer info structure
+ * @cmd: ioctl number
+ * @arg: ioctl argument
+ *
+ * Implements SSD1322FB_IOCTL_FLUSH, SSD1322FB_IOCTL_SET_PARTIAL and
+ * FBIO_WAITFORVSYNC, which waits for the SPI transfer of everything damaged
+ * so far.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+static int ssd1322fb_ioctl(struct fb_info *info, unsigned int cmd,
+                           unsigned long arg);
+
+/**
+ * ssd1322fb_schedule_flush - Queue a display update
+ * @par: Parameters for SSD1322 framebuffer
+ *
+ * Kicks the flush work after the coalescing window, which sends all damage
+ * accumulated until it runs. A flush already queued is not delayed further.
+ * Never blocks, so write() and mmap users do not wait for the SPI bus.
+ */
+static void ssd1322fb_schedule_flush(struct ssd1322fb_par *par);
+
+/**
+ * ssd1322fb_fillrect - Fill a rectangle of the framebuffer
+ * @info: Framebuffer info structure
+ * @rect: Rectangle, color and raster operation
+ *
+ * Works on whole bytes except for odd edges, then damages the rectangle and
+ * schedules a coalesced flush.
+ */
+static void ssd1322fb_fillrect(struct fb_info *info,
+                               const struct fb_fillrect *rect);
+
+/**
+ * ssd1322fb_copyarea - Copy an area of the framebuffer
+ * @info: Framebuffer info structure
+ * @area: Source and destination of the copy
+ *
+ * Rows with the same nibble alignment are copied bytewise, others pixel by
+ * pixel. Only the destination is damaged, unless the copy scrolls the whole
+ * screen, which moves the display start line instead.
+ */
+static void ssd1322fb_copyarea(struct fb_info *info,
+                               const struct fb_copyarea *area);
+
+/**
+ * ssd1322fb_copy_scroll - Detect a copy that scrolls the whole screen
+ * @par: Parameters for SSD1322 framebuffer
+ * @area: Source and destination of the copy
+ * @width: Clipped width of the copy
+ * @height: Clipped height of the copy
+ *
+ * Return: Rows the screen scrolled up by, negative for down, 0 if the copy is
+ * not a full screen scroll.
+ */
+static int ssd1322fb_copy_scroll(struct ssd1322fb_par *par,
+                                 const struct fb_copyarea *area, u32 width,
+                                 u32 height);
+
+/**
+ * ssd1322fb_imageblit - Draw an image into the framebuffer
+ * @info: Framebuffer info structure
+ * @image: Image to draw
+ *
+ * Monochrome glyphs are expanded through a table mapping each glyph byte to
+ * four framebuffer bytes, so a console character only touches its own cell.
+ * Other depths use the generic helper.
+ */
+static void ssd1322fb_imageblit(struct fb_info *info,
+                                const struct fb_image *image);
+
 /**
  * ssd1322fb_read - Read data from the framebuffer
  * @info: Framebuffer info structure
@@ -195,6 +1214,96 @@ static ssize_t ssd1322fb_read(struct fb_info *info, char __user *buf,
 static ssize_t ssd1322fb_write(struct fb_info *info, const char __user *buf,
                                size_t count, loff_t *ppos);
 
+/**
+ * ssd1322_pack9_words - Pack up to one block of 9-bit words
+ * @out: Output buffer, receives DIV_ROUND_UP(@count * 9, 8) bytes
+ * @words: Words to pack, D/C bit in bit 8
+ * @count: Number of words, at most SSD1322_PACK9_BLOCK_WORDS
+ *
+ * Unused bits of the last output byte are cleared.
+ */
+static void ssd1322_pack9_words(u8 *out, const u16 *words, size_t count);
+
+/**
+ * ssd1322_pack9_data - Pack one full block of data bytes
+ * @out: Output buffer, receives SSD1322_PACK9_BLOCK_BYTES bytes
+ * @data: SSD1322_PACK9_BLOCK_WORDS data bytes, sent with the D/C bit set
+ *
+ * Branch-free fast path of the encoder, built with a single 64-bit store.
+ */
+static void ssd1322_pack9_data(u8 *out, const u8 *data);
+
+/**
+ * ssd1322_pack9 - Encode a command and its data for 3-wire SPI
+ * @out: Output buffer, receives DIV_ROUND_UP((@data_len + 1) * 9, 8) bytes
+ * @cmd: Command byte, sent with the D/C bit cleared
+ * @data: Data bytes, sent with the D/C bit set
+ * @data_len: Number of data bytes
+ *
+ * Return: Number of bytes written to @out.
+ */
+static size_t ssd1322_pack9(u8 *out, u8 cmd, const u8 *data, size_t data_len);
+
+/**
+ * ssd1322_enc_init - Start encoding a pixel stream
+ * @enc: Encoder state
+ * @out: DMA-safe output buffer
+ * @native: Emit one u16 per 9-bit word for controllers that support them
+ * @dup: Duplicate each pixel into a whole GDDRAM byte
+ */
+static void ssd1322_enc_init(struct ssd1322_enc *enc, u8 *out, bool native,
+                             bool dup);
+
+/**
+ * ssd1322_enc_span - Encode framebuffer bytes into the pixel stream
+ * @enc: Encoder state
+ * @src: Framebuffer bytes, two 4-bit pixels each
+ * @len: Number of bytes
+ *
+ * Nibble duplication and 9-bit packing are fused into one table lookup per
+ * byte. Groups of 4 bytes are packed directly, up to 3 leftover bytes are
+ * carried over to the next span. Without duplication each byte is one data
+ * word and groups of 8 bytes are packed.
+ */
+static void ssd1322_enc_span(struct ssd1322_enc *enc, const u8 *src,
+                             size_t len);
+
+/**
+ * ssd1322_enc_finish - Flush the pixel stream encoder
+ * @enc: Encoder state
+ *
+ * Return: Total number of bytes written to the output buffer.
+ */
+static size_t ssd1322_enc_finish(struct ssd1322_enc *enc);
+
+/**
+ * ssd1322_encode_words - Encode a stream of 9-bit words
+ * @par: Parameters for SSD1322 framebuffer
+ * @out: Output buffer, at least @count u16 in size
+ * @words: Words with the D/C flag in bit 8
+ * @count: Number of words
+ *
+ * Return: Number of bytes written to @out.
+ */
+static size_t ssd1322_encode_words(struct ssd1322fb_par *par, u8 *out,
+                                   const u16 *words, size_t count);
+
+/**
+ * ssd1322_encode_cmd - Encode a command in the selected transfer format
+ * @par: Parameters for SSD1322 framebuffer
+ * @out: Output buffer
+ * @cmd: Command byte
+ * @data: Data bytes
+ * @data_len: Number of data bytes
+ *
+ * Packs the words in software, or stores one u16 per word when the SPI
+ * controller supports 9-bit words natively.
+ *
+ * Return: Number of bytes written to @out.
+ */
+static size_t ssd1322_encode_cmd(struct ssd1322fb_par *par, u8 *out, u8 cmd,
+                                 const u8 *data, size_t data_len);
+
 /**
  * ssd1322_cmd - Send a command to the SSD1322 display
  * @par: Parameters for SSD1322 framebuffer
@@ -205,10 +1314,56 @@ static ssize_t ssd1322fb_write(struct fb_info *info, const char __user *buf,
  * This function sends a command along with optional data to the SSD1322
  * display controller over the SPI bus. The D/C bit is sent before the command
  * byte, followed by any additional data bytes if required by the command.
+ * The encoded words are built in cmd_buf under par->cmd_lock.
  *
  * Return: 0 on success, negative error code on failure.
  */
 static int ssd1322_cmd(struct ssd1322fb_par *par, u8 cmd, const u8 *data,
                        size_t data_len);
 
+/**
+ * ssd1322_fit_gray_table - Turn wanted gray levels into a valid table
+ * @levels: Wanted pulse width per pixel value, 0 to SSD1322_GRAY_MAX
+ * @gs: Table for the controller, rising from the fixed 0 of GS0
+ * @inverse: Set if @gs holds a falling @levels reversed
+ *
+ * The controller only takes strictly rising tables, so levels out of order
+ * are moved up just enough, and a falling table is reversed and shown with
+ * the display inverted.
+ */
+static void ssd1322_fit_gray_table(const u8 *levels, u8 *gs, bool *inverse);
+
+/**
+ * ssd1322_load_gray_table - Send the current gray table to the panel
+ * @par: Parameters for SSD1322 framebuffer
+ *
+ * Sends the table, or selects the default one, and the matching display
+ * mode in a single transfer. The caller holds par->cmd_lock.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+static int ssd1322_load_gray_table(struct ssd1322fb_par *par);
+
+/**
+ * ssd1322_set_gray_table - Replace the gray table
+ * @par: Parameters for SSD1322 framebuffer
+ * @levels: Wanted pulse width per pixel value, or NULL for the default table
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+static int ssd1322_set_gray_table(struct ssd1322fb_par *par, const u8 *levels);
+
+/**
+ * ssd1322fb_setcmap - Set the color map
+ * @cmap: Color map entries to set
+ * @info: Framebuffer info structure
+ *
+ * In the panel's own 4-bit format the map is turned into the controller's
+ * gray table, so gamma curves and inversion cost one command instead of a
+ * pass over every frame. The other formats keep their fixed ramp.
+ *
+ * Return: 0 on success, negative error code on failure.
+ */
+static int ssd1322fb_setcmap(struct fb_cmap *cmap, struct fb_info *info);
+
 #endif /* SSD1322FB_H */
@@ -0,0 +1,96 @@
+/*
+ * SSD1322 Framebuffer Driver User Space Interface
+ * -----------------------------------------------
+ *
+ * Filename: ssd1322fb_ioctl.h
+ * License: GPL
+ *
+ * Description:
+ * ------------
+ * ioctl definitions shared between the SSD1322 framebuffer driver and user
+ * space. Include this header from applications that flush the framebuffer
+ * explicitly instead of relying on write() or the deferred I/O delay.
+ *
+ * Usage:
+ * ------
+ * - Draw into the mmap'ed framebuffer.
+ * - Submit the changed rectangle with SSD1322FB_IOCTL_FLUSH. The update
+ *   skips the coalescing delay.
+ * - Set SSD1322FB_FLUSH_WAIT, or call FBIO_WAITFORVSYNC, to block until the
+ *   SPI transfer carrying the update has completed.
+ * - Restrict the panel to a band of rows with SSD1322FB_IOCTL_SET_PARTIAL
+ *   while the rest of the screen is dark.
+ * - Upload a ring of frames with SSD1322FB_IOCTL_ANIM_LOAD and play it from
+ *   the driver with SSD1322FB_IOCTL_ANIM_PLAY, no wakeups needed per frame.
+ *   Frames are in the panel's 4-bit format, one screen each.
+ *   SSD1322FB_IOCTL_ANIM_STOP shows the framebuffer again.
+ *
+ */
+
+#ifndef SSD1322FB_IOCTL_H
+#define SSD1322FB_IOCTL_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+// Wait until the flushed area is on the panel before returning
+#define SSD1322FB_FLUSH_WAIT (1 << 0)
+
+#define SSD1322FB_FLUSH_FLAGS (SSD1322FB_FLUSH_WAIT)
+
+// Damaged rectangle in pixels, a zero width or height flushes everything
+struct ssd1322fb_flush
+{
+        __u32 x;
+        __u32 y;
+        __u32 width;
+        __u32 height;
+        __u32 flags;            // SSD1322FB_FLUSH_* flags
+};
+
+// Band of rows driven in partial display mode, a zero height leaves it
+struct ssd1322fb_partial
+{
+        __u32 y;
+        __u32 height;
+};
+
+// Ring of animation frames, a zero count frees the ring
+struct ssd1322fb_anim_load
+{
+        __u64 data;             // User pointer to nframes screens, 4 bpp
+        __u32 nframes;          // Frames in the ring
+        __u32 reserved;         // Must be zero
+};
+
+// Keep the last frame on screen when the animation ends
+#define SSD1322FB_ANIM_HOLD (1 << 0)
+
+#define SSD1322FB_ANIM_FLAGS (SSD1322FB_ANIM_HOLD)
+
+// Playback of the loaded ring
+struct ssd1322fb_anim_play
+{
+        __u32 fps;              // Frame rate, capped by the max_fps attribute
+        __u32 loops;            // Times the ring is played, 0 for forever
+        __u32 flags;            // SSD1322FB_ANIM_* flags
+};
+
+#define SSD1322FB_IOCTL_MAGIC 'S'
+
+// Mark a rectangle as damaged and send it to the panel right away
+#define SSD1322FB_IOCTL_FLUSH _IOW(SSD1322FB_IOCTL_MAGIC, 0x01, struct ssd1322fb_flush)
+
+// Only drive and update the given band of rows
+#define SSD1322FB_IOCTL_SET_PARTIAL _IOW(SSD1322FB_IOCTL_MAGIC, 0x02, struct ssd1322fb_partial)
+
+// Copy a ring of frames into the driver, stopping any playback
+#define SSD1322FB_IOCTL_ANIM_LOAD _IOW(SSD1322FB_IOCTL_MAGIC, 0x03, struct ssd1322fb_anim_load)
+
+// Play the loaded ring from a kernel timer
+#define SSD1322FB_IOCTL_ANIM_PLAY _IOW(SSD1322FB_IOCTL_MAGIC, 0x04, struct ssd1322fb_anim_play)
+
+// Stop playback and show the framebuffer again
+#define SSD1322FB_IOCTL_ANIM_STOP _IO(SSD1322FB_IOCTL_MAGIC, 0x05)
+
+#endif /* SSD1322FB_IOCTL_H */
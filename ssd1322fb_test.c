@@ -0,0 +1,510 @@
+/*
+ * SSD1322 Framebuffer Driver KUnit Tests
+ * --------------------------------------
+ *
+ * Filename: ssd1322fb_test.c
+ * License: GPL
+ *
+ * Description:
+ * ------------
+ * KUnit tests and microbenchmarks for the 9-bit packing, the pixel stream
+ * encoder and the shadow diff and window planning of the display update
+ * path. The file is included at the end of ssd1322fb.c so the tests reach
+ * the driver's static functions. Build with `make SSD1322_KUNIT=y` against
+ * a kernel with CONFIG_KUNIT; the suite runs when the module is loaded and
+ * the results go to the kernel log, or to
+ * /sys/kernel/debug/kunit/ssd1322fb/results. No panel is needed.
+ *
+ * The reference output is serialized one bit at a time, D/C bit first, the
+ * way ssd1322_cmd() originally built its buffer, so it shares no code with
+ * the packers under test.
+ *
+ */
+
+#include <kunit/test.h>
+
+// Stream lengths checked by the encoder tests
+#define SSD1322_TEST_MAX_LEN 64
+// Data bytes after the command byte checked by the command packing test
+#define SSD1322_TEST_CMD_LEN 32
+// Random cases per test
+#define SSD1322_TEST_ROUNDS 100
+// Frames encoded or diffed per benchmark
+#define SSD1322_TEST_RUNS 100
+
+// Reproducible pseudo-random test data, xorshift32
+static u32 ssd1322fb_test_rand(u32 *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+// 9-bit words on the wire, as native u16 words or packed MSB first
+static size_t ssd1322fb_test_serialize(const u16 *words, size_t count,
+				       bool native, u8 *out)
+{
+	size_t i;
+
+	if (native) {
+		memcpy(out, words, count * sizeof(u16));
+		return count * sizeof(u16);
+	}
+
+	memset(out, 0, DIV_ROUND_UP(count * 9, 8));
+	for (i = 0; i < count * 9; i++)
+		if (words[i / 9] & BIT(8 - i % 9))
+			out[i / 8] |= 0x80 >> (i % 8);
+	return DIV_ROUND_UP(count * 9, 8);
+}
+
+// One data word per GDDRAM byte, each nibble doubled for dup panels
+static size_t ssd1322fb_test_data_words(const u8 *src, size_t len, bool dup,
+					u16 *words)
+{
+	size_t count = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (dup) {
+			words[count++] = 0x100 | (src[i] >> 4) * 0x11;
+			words[count++] = 0x100 | (src[i] & 0x0F) * 0x11;
+		} else {
+			words[count++] = 0x100 | src[i];
+		}
+	}
+
+	return count;
+}
+
+static void ssd1322fb_test_fill(u8 *buf, size_t len, u32 *seed)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = ssd1322fb_test_rand(seed);
+}
+
+// A panel with nothing but the state the diff and the planner read
+static struct ssd1322fb_par *ssd1322fb_test_par(struct kunit *test, u32 width,
+						bool dup)
+{
+	struct ssd1322fb_par *par;
+	struct fb_info *info;
+
+	par = kunit_kzalloc(test, sizeof(*par), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, par);
+	info = kunit_kzalloc(test, sizeof(*info), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, info);
+
+	par->info = info;
+	par->width = width;
+	par->height = SSD1322_HEIGHT;
+	par->dup = dup;
+	par->pixels_per_col = dup ? SSD1322_PIXELS_PER_COL_DUP :
+				    SSD1322_PIXELS_PER_COL_NATIVE;
+	par->bpp = 4;
+	par->pitch = width / 2;
+	par->diff_row = ssd1322fb_diff_row_any;
+	info->var.yres = par->height;
+	info->var.yres_virtual = par->height;
+	info->fix.line_length = par->pitch;
+
+	par->buf = kunit_kzalloc(test, par->pitch * par->height, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, par->buf);
+	par->shadow = kunit_kzalloc(test, par->pitch * par->height,
+				    GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, par->shadow);
+
+	return par;
+}
+
+// Random contents, already on the panel
+static void ssd1322fb_test_sync(struct ssd1322fb_par *par, u32 *seed)
+{
+	ssd1322fb_test_fill(par->buf, par->pitch * par->height, seed);
+	memcpy(par->shadow, par->buf, par->pitch * par->height);
+	bitmap_zero(par->shadow_stale, par->height);
+}
+
+static void ssd1322fb_test_pack9_words(struct kunit *test)
+{
+	u16 words[SSD1322_PACK9_BLOCK_WORDS];
+	u8 out[SSD1322_PACK9_BLOCK_BYTES];
+	u8 ref[SSD1322_PACK9_BLOCK_BYTES];
+	u32 seed = 0x1322;
+	size_t count, len, i;
+	int round;
+
+	// Commands and data, every partial block
+	for (count = 1; count <= SSD1322_PACK9_BLOCK_WORDS; count++) {
+		for (round = 0; round < SSD1322_TEST_ROUNDS; round++) {
+			for (i = 0; i < count; i++)
+				words[i] = ssd1322fb_test_rand(&seed) & 0x1FF;
+			len = ssd1322fb_test_serialize(words, count, false,
+						       ref);
+			ssd1322_pack9_words(out, words, count);
+			KUNIT_EXPECT_MEMEQ_MSG(test, out, ref, len,
+					       "%zu words", count);
+		}
+	}
+}
+
+static void ssd1322fb_test_pack9_cmd(struct kunit *test)
+{
+	u8 out[DIV_ROUND_UP((SSD1322_TEST_CMD_LEN + 1) * 9, 8) +
+	       SSD1322_PACK9_BLOCK_BYTES];
+	u8 ref[DIV_ROUND_UP((SSD1322_TEST_CMD_LEN + 1) * 9, 8)];
+	u16 words[SSD1322_TEST_CMD_LEN + 1];
+	u8 data[SSD1322_TEST_CMD_LEN];
+	size_t data_len, out_len, ref_len;
+	u32 seed = 0x1322;
+	u8 cmd;
+
+	// A command word followed by its arguments as data words
+	for (data_len = 0; data_len <= SSD1322_TEST_CMD_LEN; data_len++) {
+		cmd = ssd1322fb_test_rand(&seed);
+		ssd1322fb_test_fill(data, data_len, &seed);
+		words[0] = cmd;
+		ssd1322fb_test_data_words(data, data_len, false, words + 1);
+		ref_len = ssd1322fb_test_serialize(words, data_len + 1, false,
+						   ref);
+
+		out_len = ssd1322_pack9(out, cmd, data, data_len);
+		KUNIT_EXPECT_EQ_MSG(test, out_len, ref_len, "%zu data bytes",
+				    data_len);
+		KUNIT_EXPECT_MEMEQ_MSG(test, out, ref, ref_len,
+				       "%zu data bytes", data_len);
+	}
+}
+
+static void ssd1322fb_test_enc_span(struct kunit *test)
+{
+	u8 src[SSD1322_TEST_MAX_LEN];
+	size_t len, pos, span, count;
+	size_t out_len, ref_len;
+	struct ssd1322_enc enc;
+	u32 seed = 0x1322;
+	unsigned int mode;
+	u8 *out, *ref;
+	u16 *words;
+
+	// Up to two words of two bytes per framebuffer byte
+	words = kunit_kmalloc_array(test, SSD1322_TEST_MAX_LEN * 2,
+				    sizeof(*words), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, words);
+	out = kunit_kmalloc(test, SSD1322_TEST_MAX_LEN * 4 +
+				  SSD1322_PACK9_BLOCK_BYTES, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, out);
+	ref = kunit_kmalloc(test, SSD1322_TEST_MAX_LEN * 4, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, ref);
+	ssd1322fb_test_fill(src, sizeof(src), &seed);
+
+	// Native or packed words with duplicated or native pixels, on
+	// streams cut into random spans so every partial group is carried
+	for (mode = 0; mode < 4; mode++) {
+		bool native = mode & 1;
+		bool dup = !(mode & 2);
+
+		for (len = 1; len <= SSD1322_TEST_MAX_LEN; len++) {
+			count = ssd1322fb_test_data_words(src, len, dup, words);
+			ref_len = ssd1322fb_test_serialize(words, count, native,
+							   ref);
+
+			ssd1322_enc_init(&enc, out, native, dup);
+			for (pos = 0; pos < len; pos += span) {
+				span = ssd1322fb_test_rand(&seed) %
+					       SSD1322_ENC_GROUP_NATIVE +
+				       1;
+				span = min(span, len - pos);
+				ssd1322_enc_span(&enc, src + pos, span);
+			}
+			out_len = ssd1322_enc_finish(&enc);
+
+			KUNIT_EXPECT_EQ_MSG(test, out_len, ref_len,
+					    "%s %s, %zu bytes",
+					    native ? "native" : "packed",
+					    dup ? "dup" : "nodup", len);
+			KUNIT_EXPECT_MEMEQ_MSG(test, out, ref, ref_len,
+					       "%s %s, %zu bytes",
+					       native ? "native" : "packed",
+					       dup ? "dup" : "nodup", len);
+		}
+	}
+}
+
+static void ssd1322fb_test_diff_row(struct kunit *test)
+{
+	struct ssd1322fb_par *par = ssd1322fb_test_par(test, 128, true);
+	struct ssd1322fb_rect spans[SSD1322_MAX_SPANS];
+	u32 seed = 0x1322;
+	u32 y = 10;
+	u8 *row;
+	int n;
+
+	ssd1322fb_test_sync(par, &seed);
+	row = par->buf + y * par->pitch;
+
+	// A row matching the shadow sends nothing
+	n = par->diff_row(par, y, 0, par->width, spans, SSD1322_MAX_SPANS);
+	KUNIT_EXPECT_EQ(test, n, 0);
+
+	// One changed byte is one column address, two pixels here
+	row[20] ^= 0x01;
+	n = par->diff_row(par, y, 0, par->width, spans, SSD1322_MAX_SPANS);
+	KUNIT_ASSERT_EQ(test, n, 1);
+	KUNIT_EXPECT_EQ(test, spans[0].x1, 40);
+	KUNIT_EXPECT_EQ(test, spans[0].x2, 42);
+	KUNIT_EXPECT_EQ(test, spans[0].y1, y);
+	KUNIT_EXPECT_EQ(test, spans[0].y2, y + 1);
+
+	// Changes outside the damaged columns are not looked at
+	n = par->diff_row(par, y, 0, 40, spans, SSD1322_MAX_SPANS);
+	KUNIT_EXPECT_EQ(test, n, 0);
+
+	// Gaps cheaper to resend than a new window are bridged
+	row[24] ^= 0x01;
+	n = par->diff_row(par, y, 0, par->width, spans, SSD1322_MAX_SPANS);
+	KUNIT_ASSERT_EQ(test, n, 1);
+	KUNIT_EXPECT_EQ(test, spans[0].x1, 40);
+	KUNIT_EXPECT_EQ(test, spans[0].x2, 50);
+
+	// Longer ones start a new span
+	row[24] ^= 0x01;
+	row[25] ^= 0x01;
+	n = par->diff_row(par, y, 0, par->width, spans, SSD1322_MAX_SPANS);
+	KUNIT_ASSERT_EQ(test, n, 2);
+	KUNIT_EXPECT_EQ(test, spans[0].x2, 42);
+	KUNIT_EXPECT_EQ(test, spans[1].x1, 50);
+	KUNIT_EXPECT_EQ(test, spans[1].x2, 52);
+
+	// Nothing is known about a stale row
+	memcpy(par->shadow + y * par->pitch, row, par->pitch);
+	set_bit(y, par->shadow_stale);
+	n = par->diff_row(par, y, 40, 50, spans, SSD1322_MAX_SPANS);
+	KUNIT_ASSERT_EQ(test, n, 1);
+	KUNIT_EXPECT_EQ(test, spans[0].x1, 0);
+	KUNIT_EXPECT_EQ(test, spans[0].x2, par->width);
+}
+
+// The diffs specialized for a geometry match the generic one
+static void ssd1322fb_test_diff_row_variants(struct kunit *test)
+{
+	static const struct {
+		u32 width;
+		bool dup;
+		int (*diff_row)(struct ssd1322fb_par *par, u32 y, u32 x1,
+				u32 x2, struct ssd1322fb_rect *spans,
+				int max_spans);
+	} variants[] = {
+		{ 128, true, ssd1322fb_diff_row_128x64 },
+		{ 256, false, ssd1322fb_diff_row_256x64 },
+	};
+	struct ssd1322fb_rect spans[SSD1322_MAX_SPANS];
+	struct ssd1322fb_rect ref[SSD1322_MAX_SPANS];
+	struct ssd1322fb_par *par;
+	u32 seed = 0x1322;
+	int i, k, n, ref_n;
+	u32 y, x1, x2;
+	int round;
+
+	for (i = 0; i < ARRAY_SIZE(variants); i++) {
+		par = ssd1322fb_test_par(test, variants[i].width,
+					 variants[i].dup);
+		ssd1322fb_test_sync(par, &seed);
+
+		for (round = 0; round < SSD1322_TEST_ROUNDS; round++) {
+			// A few changed bytes, sometimes a stale row
+			y = ssd1322fb_test_rand(&seed) % par->height;
+			for (k = ssd1322fb_test_rand(&seed) % 16; k; k--)
+				par->buf[y * par->pitch +
+					 ssd1322fb_test_rand(&seed) %
+						 par->pitch] ^= 0x10;
+			if (!(ssd1322fb_test_rand(&seed) % 8))
+				set_bit(y, par->shadow_stale);
+			x1 = round_down(ssd1322fb_test_rand(&seed) % par->width,
+					par->pixels_per_col);
+			x2 = x1 + round_up(ssd1322fb_test_rand(&seed) %
+						   (par->width - x1) + 1,
+					   par->pixels_per_col);
+			x2 = min(x2, par->width);
+
+			ref_n = ssd1322fb_diff_row_any(par, y, x1, x2, ref,
+						       SSD1322_MAX_SPANS);
+			n = variants[i].diff_row(par, y, x1, x2, spans,
+						 SSD1322_MAX_SPANS);
+			KUNIT_EXPECT_EQ_MSG(test, n, ref_n, "%ux64 row %u",
+					    par->width, y);
+			if (n == ref_n)
+				KUNIT_EXPECT_MEMEQ_MSG(test, spans, ref,
+						       n * sizeof(*spans),
+						       "%ux64 row %u",
+						       par->width, y);
+		}
+	}
+}
+
+static void ssd1322fb_test_plan_windows(struct kunit *test)
+{
+	struct ssd1322fb_par *par = ssd1322fb_test_par(test, 128, true);
+	struct ssd1322fb_rect windows[SSD1322_MAX_WINDOWS];
+	struct ssd1322fb_rect full = { 0, 0, 128, SSD1322_HEIGHT };
+	u32 seed = 0x1322;
+	u32 x, y;
+	int n;
+
+	ssd1322fb_test_sync(par, &seed);
+
+	// Nothing changed, nothing to send
+	n = ssd1322fb_plan_windows(par, &full, windows);
+	KUNIT_EXPECT_EQ(test, n, 0);
+
+	// A changed block is one window
+	for (y = 10; y < 20; y++)
+		for (x = 8; x < 16; x++)
+			par->buf[y * par->pitch + x] ^= 0xFF;
+	n = ssd1322fb_plan_windows(par, &full, windows);
+	KUNIT_ASSERT_EQ(test, n, 1);
+	KUNIT_EXPECT_EQ(test, windows[0].x1, 16);
+	KUNIT_EXPECT_EQ(test, windows[0].y1, 10);
+	KUNIT_EXPECT_EQ(test, windows[0].x2, 32);
+	KUNIT_EXPECT_EQ(test, windows[0].y2, 20);
+
+	// Windows are split where the scrolled rows wrap around GDDRAM
+	par->start_line = SSD1322_GDDRAM_ROWS - 15;
+	n = ssd1322fb_plan_windows(par, &full, windows);
+	KUNIT_ASSERT_EQ(test, n, 2);
+	KUNIT_EXPECT_EQ(test, windows[0].y1, 10);
+	KUNIT_EXPECT_EQ(test, windows[0].y2, 15);
+	KUNIT_EXPECT_EQ(test, windows[1].y1, 15);
+	KUNIT_EXPECT_EQ(test, windows[1].y2, 20);
+	KUNIT_EXPECT_EQ(test, windows[1].x1, 16);
+	KUNIT_EXPECT_EQ(test, windows[1].x2, 32);
+}
+
+// Random changes are all covered, within the window budget
+static void ssd1322fb_test_plan_coverage(struct kunit *test)
+{
+	struct ssd1322fb_par *par = ssd1322fb_test_par(test, 128, true);
+	struct ssd1322fb_rect windows[SSD1322_MAX_WINDOWS];
+	struct ssd1322fb_rect full = { 0, 0, 128, SSD1322_HEIGHT };
+	u32 seed = 0x1322;
+	u32 x, y, pos;
+	int i, k, n;
+	int round;
+	bool hit;
+
+	// Windows found past the budget are merged into the last one, which
+	// may then cross the GDDRAM wrap; the update splits it there
+	for (round = 0; round < SSD1322_TEST_ROUNDS; round++) {
+		ssd1322fb_test_sync(par, &seed);
+		par->start_line = ssd1322fb_test_rand(&seed) %
+				  SSD1322_GDDRAM_ROWS;
+		for (k = ssd1322fb_test_rand(&seed) % 64 + 1; k; k--) {
+			pos = ssd1322fb_test_rand(&seed) %
+			      (par->pitch * par->height);
+			par->buf[pos] ^= 0x01;
+		}
+
+		n = ssd1322fb_plan_windows(par, &full, windows);
+		KUNIT_EXPECT_LE(test, n, SSD1322_MAX_WINDOWS);
+
+		for (pos = 0; pos < par->pitch * par->height; pos++) {
+			if (par->buf[pos] == par->shadow[pos])
+				continue;
+			x = pos % par->pitch * 2;
+			y = pos / par->pitch;
+			hit = false;
+			for (i = 0; i < n && !hit; i++)
+				hit = x >= windows[i].x1 && x < windows[i].x2 &&
+				      y >= windows[i].y1 && y < windows[i].y2;
+			KUNIT_EXPECT_TRUE_MSG(test, hit,
+					      "pixel %u,%u not sent", x, y);
+		}
+	}
+}
+
+static void ssd1322fb_bench_encode(struct kunit *test)
+{
+	size_t frame_len = SSD1322_WIDTH * SSD1322_HEIGHT / 2;
+	struct ssd1322_enc enc;
+	u32 seed = 0x1322;
+	unsigned int mode;
+	unsigned int run;
+	size_t out_len;
+	u8 *src, *out;
+	u64 start;
+	u64 ns;
+
+	// Up to two words of two bytes per framebuffer byte
+	src = kunit_kmalloc(test, frame_len, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, src);
+	out = kunit_kmalloc(test, frame_len * 4 + SSD1322_PACK9_BLOCK_BYTES,
+			    GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, out);
+	ssd1322fb_test_fill(src, frame_len, &seed);
+
+	for (mode = 0; mode < 4; mode++) {
+		bool native = mode & 1;
+		bool dup = !(mode & 2);
+
+		out_len = 0;
+		start = ktime_get_ns();
+		for (run = 0; run < SSD1322_TEST_RUNS; run++) {
+			ssd1322_enc_init(&enc, out, native, dup);
+			ssd1322_enc_span(&enc, src, frame_len);
+			out_len = ssd1322_enc_finish(&enc);
+		}
+		ns = div_u64(ktime_get_ns() - start, SSD1322_TEST_RUNS);
+
+		kunit_info(test, "encode %s %s: %zu bytes per frame, %llu ns\n",
+			   native ? "native" : "packed", dup ? "dup" : "nodup",
+			   out_len, ns);
+	}
+}
+
+static void ssd1322fb_bench_diff(struct kunit *test)
+{
+	struct ssd1322fb_rect spans[SSD1322_MAX_SPANS];
+	struct ssd1322fb_par *par;
+	u32 seed = 0x1322;
+	unsigned int run;
+	u64 start;
+	u64 ns;
+	u32 y;
+
+	// Every row different from the panel, the most work per row
+	par = ssd1322fb_test_par(test, 128, true);
+	par->diff_row = ssd1322fb_diff_row_128x64;
+	ssd1322fb_test_fill(par->buf, par->pitch * par->height, &seed);
+	ssd1322fb_test_fill(par->shadow, par->pitch * par->height, &seed);
+
+	start = ktime_get_ns();
+	for (run = 0; run < SSD1322_TEST_RUNS; run++)
+		for (y = 0; y < par->height; y++)
+			par->diff_row(par, y, 0, par->width, spans,
+				      SSD1322_MAX_SPANS);
+	ns = div_u64(ktime_get_ns() - start, SSD1322_TEST_RUNS);
+
+	kunit_info(test, "diff %ux%u: %llu ns\n", par->width, par->height, ns);
+}
+
+static struct kunit_case ssd1322fb_test_cases[] = {
+	KUNIT_CASE(ssd1322fb_test_pack9_words),
+	KUNIT_CASE(ssd1322fb_test_pack9_cmd),
+	KUNIT_CASE(ssd1322fb_test_enc_span),
+	KUNIT_CASE(ssd1322fb_test_diff_row),
+	KUNIT_CASE(ssd1322fb_test_diff_row_variants),
+	KUNIT_CASE(ssd1322fb_test_plan_windows),
+	KUNIT_CASE(ssd1322fb_test_plan_coverage),
+	KUNIT_CASE(ssd1322fb_bench_encode),
+	KUNIT_CASE(ssd1322fb_bench_diff),
+	{}
+};
+
+static struct kunit_suite ssd1322fb_test_suite = {
+	.name = "ssd1322fb",
+	.test_cases = ssd1322fb_test_cases,
+};
+kunit_test_suite(ssd1322fb_test_suite);
@@ -0,0 +1,199 @@
+/*
+ * SSD1322 Framebuffer Driver Tracepoints
+ * --------------------------------------
+ *
+ * Filename: ssd1322fb_trace.h
+ * License: GPL
+ *
+ * Description:
+ * ------------
+ * Trace events on the display update path, for correlating panel updates
+ * with the render loop and other users of the SPI bus through ftrace or
+ * perf, e.g. `perf record -e 'ssd1322fb:*'`. Every event names the SPI
+ * device and whether the controller sends 9-bit words natively or the
+ * driver packs them.
+ *
+ * Per-transfer timing on the wire comes from the SPI core's own
+ * spi:spi_transfer_start and spi:spi_transfer_stop events. The frames
+ * traced here are queued as one message, so their completion is traced
+ * once per frame.
+ *
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ssd1322fb
+
+#if !defined(_SSD1322FB_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _SSD1322FB_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// Room for the SPI device name, e.g. spi0.0
+#define SSD1322_TRACE_DEV_LEN 16
+
+TRACE_EVENT(ssd1322fb_damage,
+        TP_PROTO(struct ssd1322fb_par *par, u32 x1, u32 y1, u32 x2, u32 y2),
+        TP_ARGS(par, x1, y1, x2, y2),
+        TP_STRUCT__entry(
+                __array(char, dev, SSD1322_TRACE_DEV_LEN)
+                __field(u32, x1)
+                __field(u32, y1)
+                __field(u32, x2)
+                __field(u32, y2)
+                __field(unsigned long, seq)
+        ),
+        TP_fast_assign(
+                strscpy(__entry->dev, dev_name(&par->spi->dev),
+                        SSD1322_TRACE_DEV_LEN);
+                __entry->x1 = x1;
+                __entry->y1 = y1;
+                __entry->x2 = x2;
+                __entry->y2 = y2;
+                __entry->seq = par->damage_seq;
+        ),
+        TP_printk("%s rect=%u,%u-%u,%u seq=%lu", __entry->dev, __entry->x1,
+                  __entry->y1, __entry->x2, __entry->y2, __entry->seq)
+);
+
+TRACE_EVENT(ssd1322fb_flush_start,
+        TP_PROTO(struct ssd1322fb_par *par, const struct ssd1322fb_rect *rect,
+                 unsigned long seq),
+        TP_ARGS(par, rect, seq),
+        TP_STRUCT__entry(
+                __array(char, dev, SSD1322_TRACE_DEV_LEN)
+                __field(u32, x1)
+                __field(u32, y1)
+                __field(u32, x2)
+                __field(u32, y2)
+                __field(unsigned long, seq)
+                __field(bool, native)
+        ),
+        TP_fast_assign(
+                strscpy(__entry->dev, dev_name(&par->spi->dev),
+                        SSD1322_TRACE_DEV_LEN);
+                __entry->x1 = rect->x1;
+                __entry->y1 = rect->y1;
+                __entry->x2 = rect->x2;
+                __entry->y2 = rect->y2;
+                __entry->seq = seq;
+                __entry->native = par->native_9bit;
+        ),
+        TP_printk("%s rect=%u,%u-%u,%u seq=%lu %s", __entry->dev,
+                  __entry->x1, __entry->y1, __entry->x2, __entry->y2,
+                  __entry->seq, __entry->native ? "native" : "packed")
+);
+
+TRACE_EVENT(ssd1322fb_encode_done,
+        TP_PROTO(struct ssd1322fb_par *par,
+                 const struct ssd1322fb_frame *frame, size_t bytes,
+                 u64 encode_ns),
+        TP_ARGS(par, frame, bytes, encode_ns),
+        TP_STRUCT__entry(
+                __array(char, dev, SSD1322_TRACE_DEV_LEN)
+                __field(unsigned int, frame)
+                __field(int, nwindows)
+                __field(size_t, bytes)
+                __field(u64, encode_ns)
+                __field(bool, native)
+        ),
+        TP_fast_assign(
+                strscpy(__entry->dev, dev_name(&par->spi->dev),
+                        SSD1322_TRACE_DEV_LEN);
+                __entry->frame = frame->index;
+                __entry->nwindows = frame->nwindows;
+                __entry->bytes = bytes;
+                __entry->encode_ns = encode_ns;
+                __entry->native = par->native_9bit;
+        ),
+        TP_printk("%s frame=%u windows=%d bytes=%zu encode_ns=%llu %s",
+                  __entry->dev, __entry->frame, __entry->nwindows,
+                  __entry->bytes, __entry->encode_ns,
+                  __entry->native ? "native" : "packed")
+);
+
+TRACE_EVENT(ssd1322fb_chunk,
+        TP_PROTO(struct ssd1322fb_par *par,
+                 const struct ssd1322fb_frame *frame,
+                 const struct spi_transfer *xfer),
+        TP_ARGS(par, frame, xfer),
+        TP_STRUCT__entry(
+                __array(char, dev, SSD1322_TRACE_DEV_LEN)
+                __field(unsigned int, frame)
+                __field(unsigned int, len)
+                __field(u32, speed_hz)
+                __field(bool, cs_change)
+                __field(bool, native)
+        ),
+        TP_fast_assign(
+                strscpy(__entry->dev, dev_name(&par->spi->dev),
+                        SSD1322_TRACE_DEV_LEN);
+                __entry->frame = frame->index;
+                __entry->len = xfer->len;
+                __entry->speed_hz = xfer->speed_hz;
+                __entry->cs_change = xfer->cs_change;
+                __entry->native = par->native_9bit;
+        ),
+        TP_printk("%s frame=%u len=%u speed_hz=%u%s %s", __entry->dev,
+                  __entry->frame, __entry->len, __entry->speed_hz,
+                  __entry->cs_change ? " cs_change" : "",
+                  __entry->native ? "native" : "packed")
+);
+
+TRACE_EVENT(ssd1322fb_frame_done,
+        TP_PROTO(struct ssd1322fb_par *par,
+                 const struct ssd1322fb_frame *frame),
+        TP_ARGS(par, frame),
+        TP_STRUCT__entry(
+                __array(char, dev, SSD1322_TRACE_DEV_LEN)
+                __field(unsigned int, frame)
+                __field(unsigned int, bytes)
+                __field(int, status)
+                __field(unsigned long, seq)
+                __field(bool, native)
+        ),
+        TP_fast_assign(
+                strscpy(__entry->dev, dev_name(&par->spi->dev),
+                        SSD1322_TRACE_DEV_LEN);
+                __entry->frame = frame->index;
+                __entry->bytes = frame->msg.actual_length;
+                __entry->status = frame->msg.status;
+                __entry->seq = frame->seq;
+                __entry->native = par->native_9bit;
+        ),
+        TP_printk("%s frame=%u bytes=%u status=%d seq=%lu %s", __entry->dev,
+                  __entry->frame, __entry->bytes, __entry->status,
+                  __entry->seq, __entry->native ? "native" : "packed")
+);
+
+TRACE_EVENT(ssd1322fb_cmds,
+        TP_PROTO(struct ssd1322fb_par *par, u8 cmd, size_t words,
+                 size_t bytes),
+        TP_ARGS(par, cmd, words, bytes),
+        TP_STRUCT__entry(
+                __array(char, dev, SSD1322_TRACE_DEV_LEN)
+                __field(u8, cmd)
+                __field(size_t, words)
+                __field(size_t, bytes)
+                __field(bool, native)
+        ),
+        TP_fast_assign(
+                strscpy(__entry->dev, dev_name(&par->spi->dev),
+                        SSD1322_TRACE_DEV_LEN);
+                __entry->cmd = cmd;
+                __entry->words = words;
+                __entry->bytes = bytes;
+                __entry->native = par->native_9bit;
+        ),
+        TP_printk("%s cmd=0x%02x words=%zu bytes=%zu %s", __entry->dev,
+                  __entry->cmd, __entry->words, __entry->bytes,
+                  __entry->native ? "native" : "packed")
+);
+
+#endif /* _SSD1322FB_TRACE_H */
+
+// The header lives next to the driver, not in include/trace/events
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ssd1322fb_trace
+#include <trace/define_trace.h>